@@ -52,6 +52,7 @@ int parse_cmd(char *s, int *r) {
     if (strcmp(s, "traceroute") == 0) *r = CMD_TRACEROUTE;
     else if (strcmp(s, "ping") == 0)  *r = CMD_PING;
     else if (strcmp(s, "mda") == 0)   *r = CMD_MDA;
+    else if (strcmp(s, "sweep") == 0) *r = CMD_SWEEP;
     else return -1;
     return 0;
 }
@@ -64,6 +65,13 @@ int parse_method(char *s, int *r) {
     return 0;
 }
 
+int parse_recv(char *s, int *r) {
+    if (strcmp(s, "pcap") == 0)     *r = RECV_PCAP;
+    else if (strcmp(s, "raw") == 0) *r = RECV_RAW;
+    else return -1;
+    return 0;
+}
+
 int parse_flow_id(char *s, int *r) {
     if (strcmp(s, "icmp-chk") == 0)       *r = FLOW_ICMP_CHK;
     else if (strcmp(s, "icmp-dst") == 0)  *r = FLOW_ICMP_DST;
@@ -92,6 +100,35 @@ int parse_int(char *s, int *r) {
     return 0;
 }
 
+int parse_flows(char *s, int *r) {
+    *r = atoi(s);
+    if (*r >= 1 && *r <= ARGS_FLOWS_MAX) return 0;
+    return -1;
+}
+
+int parse_flag(char *s, int *r) {
+    *r = 1;
+    return 0;
+}
+
+int parse_fanout(char *s, int *r) {
+    *r = atoi(s);
+    if (*r >= 0 && *r <= ARGS_FANOUT_MAX) return 0;
+    return -1;
+}
+
+int parse_send_wait(char *s, int *r) {
+    *r = atoi(s);
+    if (*r >= 0) return 0;
+    return -1;
+}
+
+int parse_path(char *s, int *r) {
+    if (strlen(s) >= ARGS_PATH_LEN) return -1;
+    strcpy((char *)r, s);
+    return 0;
+}
+
 int parse_args(int argc, char **argv, struct args *args, struct xoption *opts) {
 
     // Count the number of options
@@ -130,7 +167,7 @@ int parse_args(int argc, char **argv, struct args *args, struct xoption *opts) {
         struct xoption *o = get_xoption(opts, next);
         if (o != NULL) {
             if (o->o.has_arg == no_argument) {
-                if (o->fn(NULL, NULL) == -1) {
+                if (o->fn(NULL, o->d) == -1) {
                     free(long_opts);
                     return 1;
                 }
@@ -146,9 +183,11 @@ int parse_args(int argc, char **argv, struct args *args, struct xoption *opts) {
 
     free(long_opts);
 
-    if (optind == (argc-1)) {
+    if (optind < argc) {
         strcpy(args->dst, argv[optind]);
-    } else {
+        args->dsts = &argv[optind];
+        args->dst_count = argc - optind;
+    } else if (args->i[0] == 0) {
         printf("No destination address specified.\n");
         return 1;
     }
@@ -158,14 +197,32 @@ int parse_args(int argc, char **argv, struct args *args, struct xoption *opts) {
 
 int show_usage() {
     printf(
-"mtraceroute ADDRESS [-c command] [-w wait] [-z send-wait]\n"
+"mtraceroute ADDRESS [-c command] [-w wait] [-z send-wait] [-L]\n"
+"            [-x receive] [-F fanout]\n"
+"mtraceroute -i input [-W window] [-c command] [-w wait] [-z send-wait] [-L]\n"
+"            [-x receive] [-F fanout]\n"
 "\n"
-"  -c command: traceroute|ping|mda, default: traceroute\n"
+"  -c command: traceroute|ping|mda|sweep, default: traceroute\n"
 "  -r number of retries: default: 2\n"
-"  -w seconds to wait for answer: default: 1\n"
-"  -z milliseconds to wait between sends: default: 20\n"
+"  -w most seconds to wait for an answer, timeouts adapt to the\n"
+"     RTTs seen below that: default: 5\n"
+"  -z milliseconds to wait between sends, ping spreads its -I over\n"
+"     the addresses unless given: default: 20\n"
+"  -i file with a line \"ADDRESS [command]\" per target, - for\n"
+"     stdin, the command defaults to -c: default: none\n"
+"  -W traceroutes and pings of the input to run at once:\n"
+"     default: 100\n"
+"  -L send on raw IP sockets, the kernel resolves the next hop,\n"
+"     also works on tun, ppp and loopback links: default: off\n"
+"  -x how replies are received: pcap captures every frame, raw\n"
+"     reads ICMP and TCP from raw sockets: pcap|raw, default: pcap\n"
+"  -F receive sockets and matching threads per interface, replies\n"
+"     for one destination go to the same thread, takes the place\n"
+"     of -x, 0 to disable: default: 0\n"
 "\n"
-"  MDA: -c mda [-a confidence] [-f flow-id] [-t max-ttl]\n"
+"  MDA: -c mda [-a confidence] [-f flow-id] [-t max-ttl] [-g gap-limit]\n"
+"              [-b probe-budget] [-B run-budget] [-C cache-file]\n"
+"              [-o graph-output]\n"
 "\n"
 "    -a confidence level in %%: 90|95|99, default: 95\n"
 "    -f what flow identifier to use, some values depends on\n"
@@ -176,16 +233,48 @@ int show_usage() {
 "             udp-fl, udp-tc, tcp-sport, tcp-dst, tcp-fl, tcp-tc\n"
 "             Default: udp-sport\n"
 "    -t max number of hops to probe: default: 30\n"
+"    -g stop after this number of hops with no answer, 0 to\n"
+"       disable: default: 0\n"
+"    -b probes to send to the destination before lowering the\n"
+"       confidence, 0 for no limit: default: 0\n"
+"    -B probes to send in the whole run before lowering the\n"
+"       confidence, 0 for no limit: default: 0\n"
+"    -C file with the flows of previous runs, they are verified\n"
+"       first and the file is updated at the end: default: none\n"
+"    -o file to stream the graph to as JSON lines, - for stdout:\n"
+"       default: none\n"
 "\n"
 "  TRACEROUTE: -c traceroute [-t max-ttl] [-m method] [-p probes-at-once]\n"
+"                            [-k flows-per-hop] [-g gap-limit]\n"
+"                            [-s start-ttl] [-S stop-set-file]\n"
+"\n"
+"    -t max number of hops to probe: default: 30\n"
+"    -m method of probing: icmp|udp|tcp, default: icmp\n"
+"    -p number of hops to probe at once, 0 for the whole path: default: 3\n"
+"    -k number of flows to probe each hop with, every interface\n"
+"       they reach is listed: default: 1\n"
+"    -g stop after this number of hops with no answer, 0 to\n"
+"       disable: default: 0\n"
+"    -s ttl to start at, lower ttls are probed backwards, 0 to start\n"
+"       at the estimated distance to the destination: default: 1\n"
+"    -S file with the stop sets of previous traces, probing stops\n"
+"       at known hops and the file is updated at the end: default: none\n"
+"\n"
+"  SWEEP: ADDRESS/len -c sweep [-t max-ttl] [-m method] [-R rate]\n"
 "\n"
 "    -t max number of hops to probe: default: 30\n"
 "    -m method of probing: icmp|udp|tcp, default: icmp\n"
-"    -p number of probes to send at once: default: 3\n"
+"    -R probes per second, 0 for no limit: default: 1000\n"
 "\n"
-"  PING: -c ping [-n send-probes]\n"
+"  PING: ADDRESS... -c ping [-n send-probes] [-I interval]\n"
+"                           [-u summary-period]\n"
 "\n"
-"    -n number of probes to send: default: 5\n");
+"    -n number of probes to send to each address, 0 to send until\n"
+"       interrupted: default: 5\n"
+"    -I microseconds between probes to the same address:\n"
+"       default: 1000000\n"
+"    -u print RTT percentiles and losses every this many seconds\n"
+"       instead of each reply, 0 to disable: default: 0\n");
 
     return -1;
 }
@@ -195,28 +284,55 @@ struct args *get_args(int argc, char **argv) {
     memset(args, 0, sizeof(*args));
 
     args->a = 95;
+    args->b = 0;
+    args->B = 0;
     args->c = CMD_TRACEROUTE;
     args->f = FLOW_UDP_SPORT;
+    args->F = 0;
+    args->g = 0;
+    args->I = 1000000;
+    args->k = 1;
     args->t = 30;
+    args->u = 0;
     args->m = METHOD_ICMP;
     args->n = 5;
     args->p = 3;
     args->r = 2;
+    args->R = 1000;
+    args->s = 1;
     args->w = 5;
-    args->z = 20;
+    args->W = 100;
+    args->x = RECV_PCAP;
+    args->z = -1; // ARGS_SEND_WAIT, ping spreads -I over its addresses
 
     struct xoption opts[] = {
         {{"help",           no_argument,       NULL, 'h'}, show_usage,    NULL},
+        {{"l3",             no_argument,       NULL, 'L'}, parse_flag,    &args->L},
+        {{"receive",        required_argument, NULL, 'x'}, parse_recv,    &args->x},
+        {{"fanout",         required_argument, NULL, 'F'}, parse_fanout,  &args->F},
         {{"confidence",     required_argument, NULL, 'a'}, parse_conf,    &args->a},
+        {{"probe-budget",   required_argument, NULL, 'b'}, parse_int,     &args->b},
+        {{"run-budget",     required_argument, NULL, 'B'}, parse_int,     &args->B},
         {{"command",        required_argument, NULL, 'c'}, parse_cmd,     &args->c},
         {{"flow-id",        required_argument, NULL, 'f'}, parse_flow_id, &args->f},
         {{"max-ttl",        required_argument, NULL, 't'}, parse_int,     &args->t},
+        {{"gap-limit",      required_argument, NULL, 'g'}, parse_int,     &args->g},
         {{"method",         required_argument, NULL, 'm'}, parse_method,  &args->m},
         {{"send-probes",    required_argument, NULL, 'n'}, parse_int,     &args->n},
+        {{"interval",       required_argument, NULL, 'I'}, parse_int,     &args->I},
+        {{"summary-period", required_argument, NULL, 'u'}, parse_int,     &args->u},
         {{"probes-at-once", required_argument, NULL, 'p'}, parse_int,     &args->p},
+        {{"flows-per-hop",  required_argument, NULL, 'k'}, parse_flows,   &args->k},
         {{"retries",        required_argument, NULL, 'r'}, parse_int,     &args->r},
+        {{"rate",           required_argument, NULL, 'R'}, parse_int,     &args->R},
         {{"wait",           required_argument, NULL, 'w'}, parse_int,     &args->w},
-        {{"send-wait",      required_argument, NULL, 'z'}, parse_int,     &args->z},
+        {{"send-wait",      required_argument, NULL, 'z'}, parse_send_wait, &args->z},
+        {{"input",          required_argument, NULL, 'i'}, parse_path,    &args->i},
+        {{"window",         required_argument, NULL, 'W'}, parse_int,     &args->W},
+        {{"cache",          required_argument, NULL, 'C'}, parse_path,    &args->C},
+        {{"graph-output",   required_argument, NULL, 'o'}, parse_path,    &args->o},
+        {{"start-ttl",      required_argument, NULL, 's'}, parse_int,     &args->s},
+        {{"stop-set",       required_argument, NULL, 'S'}, parse_path,    &args->S},
         {{NULL,             no_argument,       NULL,  0 }, NULL,          NULL}
     };
 
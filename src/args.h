@@ -31,11 +31,15 @@
 #define CMD_TRACEROUTE 1
 #define CMD_PING       2
 #define CMD_MDA        3
+#define CMD_SWEEP      4
 
 #define METHOD_ICMP    1
 #define METHOD_UDP     2
 #define METHOD_TCP     3
 
+#define RECV_PCAP      1
+#define RECV_RAW       2
+
 #define FLOW_ICMP_CHK  1  // icmp-chk
 #define FLOW_ICMP_DST  2  // icmp-dst
 #define FLOW_ICMP_FL   3  // icmp-fl
@@ -49,18 +53,43 @@
 #define FLOW_TCP_FL    11 // tcp-fl
 #define FLOW_TCP_TC    12 // tcp-tc
 
+#define ARGS_PATH_LEN  256
+#define ARGS_FLOWS_MAX 255
+#define ARGS_FANOUT_MAX 64
+#define ARGS_SEND_WAIT  20 // ms, when -z is not given
+
 struct args {
     char dst[128];
+    char **dsts; // every destination given, dst is the first
+    int dst_count;
+    char C[ARGS_PATH_LEN]; // cache-file
+    char o[ARGS_PATH_LEN]; // graph-output
+    char S[ARGS_PATH_LEN]; // stop-set-file
+    char i[ARGS_PATH_LEN]; // input
     int a; // confidence
+    int b; // probe-budget
+    int B; // run-budget
     int c; // command
     int f; // flow-id
+    int F; // fanout
+    int g; // gap-limit
+    int I; // interval
+    int k; // flows-per-hop
+    int L; // l3
     int t; // max-ttl
+    int u; // summary-period
     int m; // method
     int n; // send-probes
     int p; // probes-at-once
     int r; // retries
+    int R; // rate
+    int s; // start-ttl
     int w; // wait
+    int W; // window
+    int x; // receive
     int z; // send-wait
 };
 
 struct args *get_args(int argc, char **argv);
+
+int parse_cmd(char *s, int *r);
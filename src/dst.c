@@ -45,12 +45,17 @@ struct dst *dst_create(struct mt *a, struct addr *ip_dst) {
         return NULL;
     }
 
-    struct neighbor *n = mt_get_neighbor(a, r->gateway, r->if_index);
-
-    if (n == NULL) {
-        printf("mt_get_neighbor failed\n");
-        free(d);
-        return NULL;
+    // On-link destinations are their own next hop, raw IP sockets leave
+    // resolving it to the kernel
+    const struct addr *next_hop = (r->gateway != NULL) ? r->gateway : ip_dst;
+    struct neighbor *n = NULL;
+    if (!a->l3) {
+        n = mt_get_neighbor(a, next_hop, r->if_index);
+        if (n == NULL) {
+            printf("mt_get_neighbor failed\n");
+            free(d);
+            return NULL;
+        }
     }
 
     struct interface *i = mt_get_interface(a, r->if_index);
@@ -63,15 +68,17 @@ struct dst *dst_create(struct mt *a, struct addr *ip_dst) {
 
     struct addr *if_ip = NULL;
     if (ip_dst->type == ADDR_IPV4) {
-        if_ip  = iface_ip_addr(r->if_index, ADDR_IPV4);
+        if_ip  = mt_iface_src_addr(a, r, ADDR_IPV4);
     } else if (ip_dst->type == ADDR_IPV6) {
-        if_ip  = iface_ip_addr(r->if_index, ADDR_IPV6);
+        if_ip  = mt_iface_src_addr(a, r, ADDR_IPV6);
     }
 
     d->ip_dst   = ip_dst;
     d->ip_src   = if_ip;
-    d->mac_dst  = n->hw_addr;
-    d->mac_src  = i->hw_addr;
+    d->mac_dst  = (n != NULL) ? n->hw_addr : a->l3_hw_addr;
+    d->neighbor = n;
+    if (n != NULL) n->refs++;
+    d->mac_src  = (a->l3 || i->hw_addr == NULL) ? a->l3_hw_addr : i->hw_addr;
     d->if_index = r->if_index;
 
     return d;
@@ -93,6 +100,7 @@ struct dst *dst_create_from_str(struct mt *a, const char *addr_str) {
 }
 
 void dst_destroy(struct dst *d) {
+    if (d->neighbor != NULL) d->neighbor->refs--;
     addr_destroy(d->ip_dst);
     addr_destroy(d->ip_src);
     free(d);
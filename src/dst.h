@@ -37,6 +37,7 @@ struct dst {
     struct addr *ip_src;
     struct addr *mac_dst;
     struct addr *mac_src;
+    struct neighbor *neighbor; // owns mac_dst, NULL on L3 links
     int if_index;
 };
 
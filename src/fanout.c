@@ -0,0 +1,389 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include "list.h"
+#include "fanout.h"
+#include "pdu_eth.h"
+#include "protocol_numbers.h"
+
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING 23
+#endif
+#ifndef PACKET_FANOUT_FLAG_UNIQUEID
+#define PACKET_FANOUT_FLAG_UNIQUEID 0x2000
+#endif
+
+#define FANOUT_GROUP_TRIES 16
+
+/* Returns the word replies are hashed on: the last word of the address of
+ * the destination they belong to. That is the source of echo replies and
+ * TCP segments, the destination quoted by ICMP errors, and the target of
+ * neighbor advertisements. Loads out of the packet make the program
+ * return 0, fanout_reply_key does the same.
+ */
+static struct sock_filter fanout_filter[] = {
+    BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_IPV4, 1, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_IPV6, 10, 23),
+    // IPv4
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 9),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PROTO_ICMPV4, 0, 6),
+    BPF_STMT(BPF_LDX | BPF_B   | BPF_MSH, 0),
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_IND, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 3, 1, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 11, 0, 2),
+    BPF_STMT(BPF_LD  | BPF_W   | BPF_IND, 24),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 12),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    // IPv6
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 6),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, PROTO_ICMPV6, 0, 9),
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 40),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, 3, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 3, 2, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 135, 3, 0),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 136, 2, 4),
+    BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 84),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 60),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    BPF_STMT(BPF_LD  | BPF_W   | BPF_ABS, 20),
+    BPF_STMT(BPF_RET | BPF_A, 0),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+static uint32_t fanout_word(const uint8_t *ip, uint32_t len, uint32_t pos) {
+    if (pos + 4 > len) return 0;
+    uint32_t w = 0;
+    memcpy(&w, ip + pos, sizeof(w));
+    return ntohl(w);
+}
+
+// Same as fanout_filter, ip is the network header
+static uint32_t fanout_reply_key(uint16_t type, const uint8_t *ip,
+                                 uint32_t len) {
+    if (type == ETH_TYPE_IPV4) {
+        if (len < 10) return 0;
+        if (ip[9] != PROTO_ICMPV4) return fanout_word(ip, len, 12);
+        uint32_t hl = (ip[0] & 0xf) * 4;
+        if (hl >= len) return 0;
+        if (ip[hl] != 3 && ip[hl] != 11) return fanout_word(ip, len, 12);
+        return fanout_word(ip, len, hl + 24);
+    }
+    if (type == ETH_TYPE_IPV6) {
+        if (len < 7) return 0;
+        if (ip[6] != PROTO_ICMPV6) return fanout_word(ip, len, 20);
+        if (len < 41) return 0;
+        if (ip[40] == 1 || ip[40] == 3) return fanout_word(ip, len, 84);
+        if (ip[40] == 135 || ip[40] == 136) return fanout_word(ip, len, 60);
+        return fanout_word(ip, len, 20);
+    }
+    return 0;
+}
+
+// The key the replies to a probe frame get: the last word of its
+// destination, or of the target of a neighbor solicitation
+static uint32_t fanout_probe_key(const uint8_t *buf, uint32_t len) {
+    if (len < ETH_H_SIZE) return 0;
+    uint16_t type = ntohs(((const struct eth_hdr *)buf)->type);
+    const uint8_t *ip = buf + ETH_H_SIZE;
+    len -= ETH_H_SIZE;
+
+    if (type == ETH_TYPE_IPV4) return fanout_word(ip, len, 16);
+    if (type == ETH_TYPE_IPV6) {
+        if (len > 40 && ip[6] == PROTO_ICMPV6 && ip[40] == 135) {
+            return fanout_word(ip, len, 60);
+        }
+        return fanout_word(ip, len, 36);
+    }
+    return 0;
+}
+
+static int fanout_probe_cmp(const void *a, const void *b) {
+    return a != b;
+}
+
+static void fanout_match(struct fanout_shard *s, uint8_t *frame,
+                         uint32_t len, const struct timespec *ts) {
+    uint16_t type = ntohs(((struct eth_hdr *)frame)->type);
+    uint32_t key = fanout_reply_key(type, frame + ETH_H_SIZE,
+                                    len - ETH_H_SIZE);
+    struct list *probes = hash_get(s->index, &key, sizeof(key));
+    if (probes == NULL) return;
+
+    struct list_item *it = NULL;
+    for (it = probes->first; it != NULL; it = it->next) {
+        struct probe *p = (struct probe *)it->data;
+        if (p->sent_time.tv_sec == 0 || p->response_len > 0) continue;
+        if (probe_match(p, frame, len, ts) == 1) s->f->fn(p, s->f->ctx);
+    }
+}
+
+static void fanout_ts(struct msghdr *h, struct timespec *ts) {
+    struct cmsghdr *c = NULL;
+    for (c = CMSG_FIRSTHDR(h); c != NULL; c = CMSG_NXTHDR(h, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+            memcpy(ts, CMSG_DATA(c), sizeof(*ts));
+            return;
+        }
+    }
+    clock_gettime(CLOCK_REALTIME, ts);
+}
+
+/* Reads its socket in batches and matches what it gets. Packets come
+ * without their link header, whatever the link, and are framed like the
+ * probes with the EtherType of their protocol.
+ */
+static void *fanout_thread(void *arg) {
+    struct fanout_shard *s = (struct fanout_shard *)arg;
+    struct mmsghdr msgs[FANOUT_BATCH];
+    struct iovec iovs[FANOUT_BATCH];
+    struct sockaddr_ll names[FANOUT_BATCH];
+    uint8_t ctrls[FANOUT_BATCH][FANOUT_CTRL];
+
+    while (!__atomic_load_n(&s->f->stop, __ATOMIC_ACQUIRE)) {
+        struct pollfd pfd = { s->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, FANOUT_POLL_MS) <= 0) continue;
+
+        int m = 0;
+        for (m = 0; m < FANOUT_BATCH; m++) {
+            iovs[m].iov_base = s->frame[m] + ETH_H_SIZE;
+            iovs[m].iov_len = FANOUT_BUF - ETH_H_SIZE;
+            struct msghdr *h = &msgs[m].msg_hdr;
+            memset(h, 0, sizeof(*h));
+            h->msg_name = &names[m];
+            h->msg_namelen = sizeof(names[m]);
+            h->msg_iov = &iovs[m];
+            h->msg_iovlen = 1;
+            h->msg_control = ctrls[m];
+            h->msg_controllen = FANOUT_CTRL;
+        }
+
+        int n = recvmmsg(s->fd, msgs, FANOUT_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) continue;
+
+        pthread_mutex_lock(&s->lock);
+        for (m = 0; m < n; m++) {
+            if (names[m].sll_pkttype == PACKET_OUTGOING) continue;
+            struct eth_hdr *eth = (struct eth_hdr *)s->frame[m];
+            memset(eth, 0, sizeof(*eth));
+            eth->type = names[m].sll_protocol;
+            struct timespec ts;
+            fanout_ts(&msgs[m].msg_hdr, &ts);
+            fanout_match(s, s->frame[m], ETH_H_SIZE + msgs[m].msg_len, &ts);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
+static int fanout_join(int fd, int group) {
+    int mode = group | (PACKET_FANOUT_CBPF << 16);
+    return setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &mode, sizeof(mode));
+}
+
+/* Creates the group with the first socket. Groups are shared by the whole
+ * network namespace, so the kernel is asked for an id no other group has.
+ * Kernels before 4.19 cannot pick one, the id is then derived from the pid
+ * and the interface, trying the next ones while a group of another type
+ * holds it.
+ */
+static int fanout_create(int fd, int if_index) {
+    int mode = (PACKET_FANOUT_CBPF | PACKET_FANOUT_FLAG_UNIQUEID) << 16;
+    if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &mode, sizeof(mode)) == 0) {
+        socklen_t len = sizeof(mode);
+        if (getsockopt(fd, SOL_PACKET, PACKET_FANOUT, &mode, &len) == -1) {
+            return -1;
+        }
+        return mode & 0xffff;
+    }
+
+    int k = 0;
+    for (k = 0; k < FANOUT_GROUP_TRIES; k++) {
+        int group = (getpid() * 31 + if_index + k) & 0xffff;
+        if (fanout_join(fd, group) == 0) return group;
+    }
+    return -1;
+}
+
+// Joins the group, or creates it when there is none yet
+static int fanout_socket(int if_index, int *group) {
+    int fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_ALL));
+    if (fd == -1) return -1;
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_ALL);
+    addr.sll_ifindex = if_index;
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    if (*group == -1) {
+        *group = fanout_create(fd, if_index);
+    } else if (fanout_join(fd, *group) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (*group == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Joins count sockets to a new fanout group on the interface and starts a
+// thread per socket
+struct fanout *fanout_open(int if_index, int count, fanout_match_fn fn,
+                           void *ctx) {
+    if (count < 1 || count > FANOUT_MAX) return NULL;
+
+    struct fanout *f = malloc(sizeof(*f));
+    if (f == NULL) return NULL;
+    memset(f, 0, sizeof(*f));
+    f->if_index = if_index;
+    f->fn = fn;
+    f->ctx = ctx;
+    f->shards = calloc(count, sizeof(*f->shards));
+    if (f->shards == NULL) {
+        free(f);
+        return NULL;
+    }
+
+    int group = -1;
+    for (f->count = 0; f->count < count; f->count++) {
+        struct fanout_shard *s = &f->shards[f->count];
+        s->f = f;
+        s->fd = fanout_socket(if_index, &group);
+        s->index = hash_create(0);
+        if (s->fd == -1 || s->index == NULL) {
+            if (s->fd != -1) close(s->fd);
+            if (s->index != NULL) hash_destroy(s->index);
+            break;
+        }
+        pthread_mutex_init(&s->lock, NULL);
+    }
+
+    struct sock_fprog prog;
+    prog.len = sizeof(fanout_filter) / sizeof(fanout_filter[0]);
+    prog.filter = fanout_filter;
+    if (f->count < count ||
+        setsockopt(f->shards[0].fd, SOL_PACKET, PACKET_FANOUT_DATA, &prog,
+                   sizeof(prog)) == -1) {
+        fanout_close(f);
+        return NULL;
+    }
+
+    int k = 0;
+    for (k = 0; k < f->count; k++) {
+        pthread_create(&f->shards[k].thread, NULL, &fanout_thread,
+                       &f->shards[k]);
+    }
+    return f;
+}
+
+static void fanout_free_list(const void *key, uint32_t key_len, void *data,
+                             void *ctx) {
+    list_destroy((struct list *)data);
+}
+
+void fanout_close(struct fanout *f) {
+    __atomic_store_n(&f->stop, 1, __ATOMIC_RELEASE);
+    int k = 0;
+    for (k = 0; k < f->count; k++) {
+        struct fanout_shard *s = &f->shards[k];
+        if (s->thread != 0) pthread_join(s->thread, NULL);
+        close(s->fd);
+        hash_fn(s->index, &fanout_free_list, NULL);
+        hash_destroy(s->index);
+        pthread_mutex_destroy(&s->lock);
+    }
+    free(f->shards);
+    free(f);
+}
+
+static struct fanout_shard *fanout_shard(struct fanout *f,
+                                         const struct probe *p) {
+    uint32_t key = fanout_probe_key(p->probe, p->probe_len);
+    return &f->shards[key % f->count];
+}
+
+// Locks the shard of a probe, it can then be read and changed
+void fanout_lock(struct fanout *f, const struct probe *p) {
+    pthread_mutex_lock(&fanout_shard(f, p)->lock);
+}
+
+void fanout_unlock(struct fanout *f, const struct probe *p) {
+    pthread_mutex_unlock(&fanout_shard(f, p)->lock);
+}
+
+// Indexes a probe in the shard its replies go to, with the shard locked
+void fanout_add(struct fanout *f, struct probe *p) {
+    uint32_t key = fanout_probe_key(p->probe, p->probe_len);
+    struct fanout_shard *s = &f->shards[key % f->count];
+    struct list *probes = hash_get(s->index, &key, sizeof(key));
+    if (probes == NULL) {
+        probes = list_create();
+        if (probes == NULL) return;
+        if (hash_put(s->index, &key, sizeof(key), probes) == -1) {
+            list_destroy(probes);
+            return;
+        }
+    }
+    list_insert(probes, p);
+}
+
+// Takes a probe out of its shard, with the shard locked
+void fanout_remove(struct fanout *f, struct probe *p) {
+    uint32_t key = fanout_probe_key(p->probe, p->probe_len);
+    struct fanout_shard *s = &f->shards[key % f->count];
+    struct list *probes = hash_get(s->index, &key, sizeof(key));
+    if (probes == NULL) return;
+    list_remove(probes, p, &fanout_probe_cmp);
+    if (probes->count == 0) {
+        hash_remove(s->index, &key, sizeof(key));
+        list_destroy(probes);
+    }
+}
@@ -0,0 +1,88 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __FANOUT_H__
+#define __FANOUT_H__
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "hash.h"
+#include "probe.h"
+
+#define FANOUT_MAX   64
+#define FANOUT_BATCH 32
+#define FANOUT_BUF   1518
+#define FANOUT_CTRL  64
+#define FANOUT_POLL_MS 100
+
+// Called with the shard locked for every probe a frame answered
+typedef void (*fanout_match_fn)(struct probe *p, void *ctx);
+
+struct fanout;
+
+// A receive socket of the group, the thread that reads it and the probes
+// whose replies the group hashes to it
+struct fanout_shard {
+    struct fanout *f;
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    struct hash *index; // key of the probe destination to a list of probes
+    uint8_t frame[FANOUT_BATCH][FANOUT_BUF];
+};
+
+/* PACKET_FANOUT group of receive sockets on one interface. A cBPF program
+ * sends each reply to the socket of the destination of the probe it
+ * answers, so every thread matches against its own probes only. The
+ * caller reads and changes a probe with only its shard locked, which
+ * holds up the one thread that may match it.
+ */
+struct fanout {
+    int if_index;
+    int count;
+    int stop;
+    fanout_match_fn fn;
+    void *ctx;
+    struct fanout_shard *shards;
+};
+
+struct fanout *fanout_open(int if_index, int count, fanout_match_fn fn,
+                           void *ctx);
+
+void fanout_close(struct fanout *f);
+
+void fanout_lock(struct fanout *f, const struct probe *p);
+
+void fanout_unlock(struct fanout *f, const struct probe *p);
+
+void fanout_add(struct fanout *f, struct probe *p);
+
+void fanout_remove(struct fanout *f, struct probe *p);
+
+#endif // __FANOUT_H__
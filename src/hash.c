@@ -0,0 +1,180 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+// Marks an empty slot that once held an item, so lookups keep probing
+static uint8_t hash_deleted;
+
+// FNV-1a
+uint32_t hash_bytes(const void *key, uint32_t key_len) {
+    const uint8_t *k = (const uint8_t *)key;
+    uint32_t h = 2166136261u;
+    uint32_t i = 0;
+    for (i = 0; i < key_len; i++) {
+        h ^= k[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+struct hash *hash_create(uint32_t size) {
+    struct hash *h = malloc(sizeof(*h));
+    if (h == NULL) return NULL;
+    memset(h, 0, sizeof(*h));
+
+    // Keep the size a power of two to replace modulo by a mask
+    h->size = HASH_MIN_SIZE;
+    while (h->size < size) h->size <<= 1;
+
+    h->items = calloc(h->size, sizeof(*h->items));
+    if (h->items == NULL) {
+        free(h);
+        return NULL;
+    }
+
+    return h;
+}
+
+void hash_destroy(struct hash *h) {
+    uint32_t i = 0;
+    for (i = 0; i < h->size; i++) {
+        if (h->items[i].key != NULL && h->items[i].key != &hash_deleted) {
+            free(h->items[i].key);
+        }
+    }
+    free(h->items);
+    free(h);
+}
+
+static int hash_item_eq(const struct hash_item *it, uint32_t hash,
+                        const void *key, uint32_t key_len) {
+    if (it->key == NULL || it->key == &hash_deleted) return 0;
+    if (it->hash != hash || it->key_len != key_len) return 0;
+    return memcmp(it->key, key, key_len) == 0;
+}
+
+static struct hash_item *hash_find(const struct hash *h, uint32_t hash,
+                                   const void *key, uint32_t key_len) {
+    uint32_t mask = h->size - 1;
+    uint32_t pos = hash & mask;
+    while (h->items[pos].key != NULL) {
+        if (hash_item_eq(&h->items[pos], hash, key, key_len)) {
+            return &h->items[pos];
+        }
+        pos = (pos + 1) & mask;
+    }
+    return NULL;
+}
+
+static int hash_resize(struct hash *h, uint32_t size) {
+    struct hash_item *items = calloc(size, sizeof(*items));
+    if (items == NULL) return -1;
+
+    uint32_t mask = size - 1;
+    uint32_t i = 0;
+    for (i = 0; i < h->size; i++) {
+        struct hash_item *it = &h->items[i];
+        if (it->key == NULL || it->key == &hash_deleted) continue;
+        uint32_t pos = it->hash & mask;
+        while (items[pos].key != NULL) pos = (pos + 1) & mask;
+        items[pos] = *it;
+    }
+
+    free(h->items);
+    h->items = items;
+    h->size  = size;
+    h->used  = h->count;
+    return 0;
+}
+
+void *hash_get(const struct hash *h, const void *key, uint32_t key_len) {
+    struct hash_item *it = hash_find(h, hash_bytes(key, key_len), key, key_len);
+    if (it == NULL) return NULL;
+    return it->data;
+}
+
+int hash_put(struct hash *h, const void *key, uint32_t key_len, void *data) {
+    uint32_t hash = hash_bytes(key, key_len);
+    struct hash_item *it = hash_find(h, hash, key, key_len);
+    if (it != NULL) {
+        it->data = data;
+        return 0;
+    }
+
+    // Keep the load factor (including deleted items) below 3/4
+    if ((h->used + 1) * 4 > h->size * 3) {
+        uint32_t size = h->size;
+        if ((h->count + 1) * 2 > size) size <<= 1;
+        if (hash_resize(h, size) == -1) return -1;
+    }
+
+    uint8_t *k = malloc(key_len);
+    if (k == NULL) return -1;
+    memcpy(k, key, key_len);
+
+    uint32_t mask = h->size - 1;
+    uint32_t pos = hash & mask;
+    while (h->items[pos].key != NULL && h->items[pos].key != &hash_deleted) {
+        pos = (pos + 1) & mask;
+    }
+
+    if (h->items[pos].key == NULL) h->used++;
+    h->items[pos].key     = k;
+    h->items[pos].key_len = key_len;
+    h->items[pos].hash    = hash;
+    h->items[pos].data    = data;
+    h->count++;
+    return 0;
+}
+
+void *hash_remove(struct hash *h, const void *key, uint32_t key_len) {
+    struct hash_item *it = hash_find(h, hash_bytes(key, key_len), key, key_len);
+    if (it == NULL) return NULL;
+
+    void *data = it->data;
+    free(it->key);
+    it->key  = &hash_deleted;
+    it->data = NULL;
+    h->count--;
+    return data;
+}
+
+// Execute a function for each item in the table
+void hash_fn(struct hash *h, void (*fn)(const void *, uint32_t, void *, void *),
+             void *ctx) {
+    uint32_t i = 0;
+    for (i = 0; i < h->size; i++) {
+        struct hash_item *it = &h->items[i];
+        if (it->key == NULL || it->key == &hash_deleted) continue;
+        fn(it->key, it->key_len, it->data, ctx);
+    }
+}
@@ -0,0 +1,66 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stdint.h>
+
+#define HASH_MIN_SIZE 16
+
+struct hash_item {
+    uint8_t *key;
+    uint32_t key_len;
+    uint32_t hash;
+    void *data;
+};
+
+// Open addressing (linear probing) table from binary keys to data pointers
+struct hash {
+    struct hash_item *items;
+    uint32_t size;
+    uint32_t count;
+    uint32_t used; // count plus deleted items
+};
+
+struct hash *hash_create(uint32_t size);
+
+void hash_destroy(struct hash *h);
+
+void *hash_get(const struct hash *h, const void *key, uint32_t key_len);
+
+int hash_put(struct hash *h, const void *key, uint32_t key_len, void *data);
+
+void *hash_remove(struct hash *h, const void *key, uint32_t key_len);
+
+void hash_fn(struct hash *h, void (*fn)(const void *, uint32_t, void *, void *),
+             void *ctx);
+
+uint32_t hash_bytes(const void *key, uint32_t key_len);
+
+#endif // __HASH_H__
@@ -0,0 +1,99 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "histogram.h"
+
+/* Values below HISTOGRAM_SUB get a bucket each. Above that, a value whose
+ * highest set bit is b falls in range b - HISTOGRAM_SUB_BITS + 1, and the
+ * HISTOGRAM_SUB_BITS bits below its highest one pick the bucket inside it.
+ */
+static uint32_t histogram_bucket(uint32_t v) {
+    if (v < HISTOGRAM_SUB) return v;
+    int b = 31 - __builtin_clz(v);
+    int shift = b - HISTOGRAM_SUB_BITS;
+    uint32_t range = shift + 1;
+    uint32_t sub = (v >> shift) & (HISTOGRAM_SUB - 1);
+    return range * HISTOGRAM_SUB + sub;
+}
+
+// Highest value that falls in a bucket
+static uint32_t histogram_bucket_max(uint32_t bucket) {
+    if (bucket < HISTOGRAM_SUB) return bucket;
+    uint32_t range = bucket / HISTOGRAM_SUB;
+    uint32_t sub = bucket % HISTOGRAM_SUB;
+    int shift = range - 1;
+    uint64_t low = ((uint64_t)(HISTOGRAM_SUB + sub)) << shift;
+    uint64_t high = low + ((uint64_t)1 << shift) - 1;
+    return (high > UINT32_MAX) ? UINT32_MAX : (uint32_t)high;
+}
+
+struct histogram *histogram_create(void) {
+    struct histogram *h = malloc(sizeof(*h));
+    if (h == NULL) return NULL;
+    histogram_reset(h);
+    return h;
+}
+
+void histogram_destroy(struct histogram *h) {
+    free(h);
+}
+
+void histogram_reset(struct histogram *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+void histogram_add(struct histogram *h, uint32_t value) {
+    h->counts[histogram_bucket(value)]++;
+    if (h->count == 0 || value < h->min) h->min = value;
+    if (h->count == 0 || value > h->max) h->max = value;
+    h->sum += value;
+    h->count++;
+}
+
+// Upper bound of the bucket holding the p-th percentile (0 < p <= 100)
+uint32_t histogram_percentile(const struct histogram *h, double p) {
+    if (h->count == 0) return 0;
+
+    uint64_t rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > h->count) rank = h->count;
+
+    uint64_t seen = 0;
+    uint32_t i = 0;
+    for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            uint32_t v = histogram_bucket_max(i);
+            return (v > h->max) ? h->max : v;
+        }
+    }
+    return h->max;
+}
@@ -35,6 +35,7 @@
 #include <ifaddrs.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <linux/if_packet.h>
 
 #include "iface.h"
 
@@ -86,3 +87,143 @@ struct addr *iface_ip_addr(int if_index, int type) {
     freeifaddrs(if_addrs);
     return addr;
 }
+
+struct iface_entry {
+    int if_index;
+    char if_name[IF_NAMESIZE];
+    struct addr *hw_addr;
+    struct list *addrs; // IPv4 and IPv6, in the order of getifaddrs
+};
+
+static void iface_entry_destroy(struct iface_entry *e) {
+    while (e->addrs->count > 0) addr_destroy((struct addr *)list_pop(e->addrs));
+    list_destroy(e->addrs);
+    if (e->hw_addr != NULL) addr_destroy(e->hw_addr);
+    free(e);
+}
+
+static struct iface_entry *iface_table_find(const struct iface_table *t,
+                                            const char *if_name) {
+    struct list_item *it = NULL;
+    for (it = t->ifaces->first; it != NULL; it = it->next) {
+        struct iface_entry *e = (struct iface_entry *)it->data;
+        if (strcmp(e->if_name, if_name) == 0) return e;
+    }
+    return NULL;
+}
+
+static struct iface_entry *iface_table_get(struct iface_table *t,
+                                           const char *if_name) {
+    struct iface_entry *e = iface_table_find(t, if_name);
+    if (e != NULL) return e;
+
+    e = malloc(sizeof(*e));
+    if (e == NULL) return NULL;
+    memset(e, 0, sizeof(*e));
+    strncpy(e->if_name, if_name, IF_NAMESIZE - 1);
+    e->addrs = list_create();
+    if (e->addrs == NULL) {
+        free(e);
+        return NULL;
+    }
+    list_insert(t->ifaces, e);
+    return e;
+}
+
+// Takes the addresses of every interface from a single getifaddrs, the
+// AF_PACKET entries give the index and hardware address of each
+struct iface_table *iface_table_create(void) {
+    struct ifaddrs *if_addrs;
+    if (getifaddrs(&if_addrs) == -1) return NULL;
+
+    struct iface_table *t = malloc(sizeof(*t));
+    if (t == NULL) goto exit;
+    t->ifaces = list_create();
+    if (t->ifaces == NULL) {
+        free(t);
+        t = NULL;
+        goto exit;
+    }
+
+    struct ifaddrs *ifa;
+    for (ifa = if_addrs; ifa != NULL; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == NULL) continue;
+        int family = ifa->ifa_addr->sa_family;
+        if (family != AF_PACKET && family != AF_INET && family != AF_INET6) {
+            continue;
+        }
+
+        struct iface_entry *e = iface_table_get(t, ifa->ifa_name);
+        if (e == NULL) continue;
+
+        if (family == AF_PACKET) {
+            struct sockaddr_ll *sll = (struct sockaddr_ll *)ifa->ifa_addr;
+            e->if_index = sll->sll_ifindex;
+            if (sll->sll_hatype == ARPHRD_ETHER && e->hw_addr == NULL &&
+                sll->sll_halen == ADDR_ETH_SIZE) {
+                e->hw_addr = addr_create(ADDR_ETHERNET, sll->sll_addr);
+            }
+        } else {
+            struct addr *addr = addr_create_from_sockaddr(ifa->ifa_addr);
+            if (addr != NULL) list_insert(e->addrs, addr);
+        }
+    }
+
+exit:
+    freeifaddrs(if_addrs);
+    return t;
+}
+
+void iface_table_destroy(struct iface_table *t) {
+    while (t->ifaces->count > 0) {
+        iface_entry_destroy((struct iface_entry *)list_pop(t->ifaces));
+    }
+    list_destroy(t->ifaces);
+    free(t);
+}
+
+static const struct iface_entry *iface_table_entry(const struct iface_table *t,
+                                                   int if_index) {
+    struct list_item *it = NULL;
+    for (it = t->ifaces->first; it != NULL; it = it->next) {
+        const struct iface_entry *e = (const struct iface_entry *)it->data;
+        if (e->if_index == if_index) return e;
+    }
+    return NULL;
+}
+
+struct addr *iface_table_hw_addr(const struct iface_table *t, int if_index) {
+    const struct iface_entry *e = iface_table_entry(t, if_index);
+    if (e == NULL || e->hw_addr == NULL) return NULL;
+    return addr_copy(e->hw_addr);
+}
+
+static int iface_link_local(const struct addr *addr) {
+    return addr->type == ADDR_IPV6 && addr->addr[0] == 0xfe &&
+           (addr->addr[1] & 0xc0) == 0x80;
+}
+
+// An interface may have several addresses of a family, link-local IPv6
+// ones are only used when there is nothing else
+struct addr *iface_table_ip_addr(const struct iface_table *t, int if_index,
+                                 int type) {
+    const struct iface_entry *e = iface_table_entry(t, if_index);
+    if (e == NULL) return NULL;
+
+    const struct addr *found = NULL;
+    struct list_item *it = NULL;
+    for (it = e->addrs->first; it != NULL; it = it->next) {
+        const struct addr *addr = (const struct addr *)it->data;
+        if (addr->type != type) continue;
+        if (found == NULL || iface_link_local(found)) found = addr;
+        if (!iface_link_local(found)) break;
+    }
+    return (found != NULL) ? addr_copy(found) : NULL;
+}
+
+// Every IPv4 and IPv6 address of the interface, owned by the table
+const struct list *iface_table_ip_addrs(const struct iface_table *t,
+                                        int if_index) {
+    const struct iface_entry *e = iface_table_entry(t, if_index);
+    return (e != NULL) ? e->addrs : NULL;
+}
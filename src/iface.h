@@ -30,8 +30,22 @@
 #define __IFACE_H__
 
 #include "addr.h"
+#include "list.h"
 
 struct addr *iface_hw_addr(int if_index);
 struct addr *iface_ip_addr(int if_index, int type);
 
+// Hardware and IP addresses of every interface, read once
+struct iface_table {
+    struct list *ifaces;
+};
+
+struct iface_table *iface_table_create(void);
+void iface_table_destroy(struct iface_table *t);
+struct addr *iface_table_hw_addr(const struct iface_table *t, int if_index);
+struct addr *iface_table_ip_addr(const struct iface_table *t, int if_index,
+                                 int type);
+const struct list *iface_table_ip_addrs(const struct iface_table *t,
+                                        int if_index);
+
 #endif // __IFACE_H__
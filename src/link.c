@@ -31,9 +31,14 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <netinet/ether.h>
+#include <netinet/in.h>
+#include <net/if.h>
 #include <linux/if_packet.h>
 
 #include "link.h"
+#include "pdu_eth.h"
+#include "pdu_ipv4.h"
+#include "pdu_ipv6.h"
 
 struct link *link_open(int if_index) {
     struct link *l = malloc(sizeof(*l));
@@ -51,15 +56,92 @@ struct link *link_open(int if_index) {
     return l;
 }
 
+static int link_raw_socket(int family, int if_index) {
+    int fd = socket(family, SOCK_RAW, IPPROTO_RAW);
+    if (fd == -1) return -1;
+
+    // Probes leave through the interface they are captured on, the kernel
+    // still picks the next hop and resolves its address
+    char if_name[IF_NAMESIZE];
+    if (if_indextoname(if_index, if_name) != NULL) {
+        setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, if_name, strlen(if_name));
+    }
+    return fd;
+}
+
+/* Opens raw IPv4 and IPv6 sockets instead of a packet socket. IPPROTO_RAW
+ * implies IP_HDRINCL, so the IP header built with the probe is sent as is.
+ * Works on links without Ethernet framing, e.g. tun, ppp or loopback.
+ */
+struct link *link_open_l3(int if_index) {
+    struct link *l = malloc(sizeof(*l));
+    if (l == NULL) return NULL;
+    memset(l, 0, sizeof(*l));
+
+    l->if_index = if_index;
+    l->l3 = 1;
+    l->fd = link_raw_socket(AF_INET, if_index);
+    l->fd6 = link_raw_socket(AF_INET6, if_index);
+
+    if (l->fd == -1 && l->fd6 == -1) {
+        free(l);
+        return NULL;
+    }
+
+    return l;
+}
+
 void link_close(struct link *l) {
     if (l == NULL) return;
-    close(l->fd);
+    if (l->fd != -1) close(l->fd);
+    if (l->l3 && l->fd6 != -1) close(l->fd6);
     free(l);
 }
 
+// Sends the IP packet of a frame to the destination in its header
+static int link_write_l3(struct link *l, uint8_t *buf, uint32_t len) {
+    if (len < ETH_H_SIZE) return -1;
+    struct eth_hdr *eth = (struct eth_hdr *)buf;
+    uint8_t *ip = buf + ETH_H_SIZE;
+    len -= ETH_H_SIZE;
+
+    struct sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+
+    if (ntohs(eth->type) == ETH_TYPE_IPV4 && len >= IPV4_H_SIZE) {
+        struct sockaddr_in *sin = (struct sockaddr_in *)&addr;
+        sin->sin_family = AF_INET;
+        memcpy(&sin->sin_addr, &((struct ipv4_hdr *)ip)->dst_addr,
+               sizeof(sin->sin_addr));
+        return sendto(l->fd, ip, len, 0, (struct sockaddr *)sin, sizeof(*sin));
+    }
+
+    if (ntohs(eth->type) == ETH_TYPE_IPV6 && len >= IPV6_H_SIZE) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&addr;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_scope_id = l->if_index;
+        memcpy(&sin6->sin6_addr, ((struct ipv6_hdr *)ip)->dst_addr,
+               sizeof(sin6->sin6_addr));
+        return sendto(l->fd6, ip, len, 0, (struct sockaddr *)sin6,
+                      sizeof(*sin6));
+    }
+
+    return -1;
+}
+
 int link_write(struct link *l, uint8_t *buf, uint32_t len, struct timespec *t) {
     if (l == NULL) return -1;
-    
+
+    if (l->l3) {
+        if (t != NULL) clock_gettime(CLOCK_REALTIME, t);
+        int sent = link_write_l3(l, buf, len);
+        if (sent > 0) {
+            l->write_count++;
+            l->write_bytes += sent;
+        }
+        return sent;
+    }
+
     // To correct an annoying error in Valgrind
     // Looks like it is because of alignment of sockaddr_ll
     struct sockaddr_storage addr;
@@ -34,12 +34,15 @@
 
 struct link {
     int fd;
+    int fd6; // IPv6 raw socket of an L3 link
+    int l3;  // frames are sent without their Ethernet header
     int if_index;
     uint32_t write_count;
     uint32_t write_bytes;
 };
 
 struct link *link_open(int if_index);
+struct link *link_open_l3(int if_index);
 void link_close(struct link *l);
 int link_write(struct link *l, uint8_t *buf, uint32_t len, struct timespec *t);
 
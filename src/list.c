@@ -69,28 +69,47 @@ void *list_remove(struct list *l, const void *cmp_data,
                   int (*cmp_fn)(const void *, const void *)) {
     struct list_item *i;
     for (i = l->first; i != NULL; i = i->next) {
-        void *data = i->data;
-        if (cmp_fn(cmp_data, data) == 0) {
-            if (i->previous == NULL) {
-                l->first = i->next;
-            } else {
-                i->previous->next = i->next;
-            }
-
-            if (i->next == NULL) {
-                l->last = i->previous;
-            } else {
-                i->next->previous = i->previous;
-            }
-
-            l->count--;
-            free(i);
-            return data;
-        }
+        if (cmp_fn(cmp_data, i->data) == 0) return list_remove_item(l, i);
     }
     return NULL;
 }
 
+// Remove an item found while walking the list and returns the data
+void *list_remove_item(struct list *l, struct list_item *i) {
+    void *data = i->data;
+    if (i->previous == NULL) {
+        l->first = i->next;
+    } else {
+        i->previous->next = i->next;
+    }
+
+    if (i->next == NULL) {
+        l->last = i->previous;
+    } else {
+        i->next->previous = i->previous;
+    }
+
+    l->count--;
+    free(i);
+    return data;
+}
+
+// Moves an item found while walking the list to its end
+void list_move_last(struct list *l, struct list_item *i) {
+    if (l->last == i) return;
+    if (i->previous == NULL) {
+        l->first = i->next;
+    } else {
+        i->previous->next = i->next;
+    }
+    i->next->previous = i->previous;
+
+    i->previous = l->last;
+    i->next = NULL;
+    l->last->next = i;
+    l->last = i;
+}
+
 // Remove the first item and returns the data
 void *list_pop(struct list *l) {
     if (l->count == 0) return NULL;
@@ -50,6 +50,10 @@ int list_insert(struct list *l, void *data);
 void *list_remove(struct list *l, const void *cmp_data,
 	              int (*cmp_fn)(const void *, const void *));
 
+void *list_remove_item(struct list *l, struct list_item *i);
+
+void list_move_last(struct list *l, struct list_item *i);
+
 void *list_pop(struct list *l);
 
 struct list_item *list_find(struct list *l, const void *cmp_data,
@@ -0,0 +1,140 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lru.h"
+
+struct lru *lru_create(uint32_t max, lru_destroy_fn destroy,
+                       lru_evictable_fn evictable) {
+    struct lru *c = malloc(sizeof(*c));
+    if (c == NULL) return NULL;
+    memset(c, 0, sizeof(*c));
+
+    c->max = max;
+    c->destroy = destroy;
+    c->evictable = evictable;
+    c->index = hash_create(max);
+    c->entries = list_create();
+    if (c->index == NULL || c->entries == NULL) {
+        if (c->index != NULL) hash_destroy(c->index);
+        if (c->entries != NULL) list_destroy(c->entries);
+        free(c);
+        return NULL;
+    }
+
+    return c;
+}
+
+void lru_destroy(struct lru *c) {
+    lru_clear(c);
+    hash_destroy(c->index);
+    list_destroy(c->entries);
+    free(c);
+}
+
+static void lru_remove(struct lru *c, struct list_item *it) {
+    struct lru_entry *e = (struct lru_entry *)it->data;
+    hash_remove(c->index, e->key, e->key_len);
+    list_remove_item(c->entries, it);
+    if (c->destroy != NULL) c->destroy(e->data);
+    free(e);
+}
+
+// Marks the entry as the most recently used
+void *lru_get(struct lru *c, const void *key, uint32_t key_len) {
+    struct list_item *it = hash_get(c->index, key, key_len);
+    if (it == NULL) return NULL;
+    list_move_last(c->entries, it);
+    return ((struct lru_entry *)it->data)->data;
+}
+
+// Looks an entry up leaving the order of use as it is
+void *lru_peek(const struct lru *c, const void *key, uint32_t key_len) {
+    struct list_item *it = hash_get(c->index, key, key_len);
+    if (it == NULL) return NULL;
+    return ((struct lru_entry *)it->data)->data;
+}
+
+// Evicts the least recently used entry that may be, if there is none
+// the cache grows past max until one is
+static void lru_evict(struct lru *c) {
+    struct list_item *it = NULL;
+    for (it = c->entries->first; it != NULL; it = it->next) {
+        struct lru_entry *e = (struct lru_entry *)it->data;
+        if (c->evictable == NULL || c->evictable(e->data)) {
+            lru_remove(c, it);
+            return;
+        }
+    }
+}
+
+int lru_put(struct lru *c, const void *key, uint32_t key_len, void *data) {
+    if (key_len > LRU_KEY_MAX) return -1;
+
+    struct list_item *it = hash_get(c->index, key, key_len);
+    if (it != NULL) {
+        struct lru_entry *e = (struct lru_entry *)it->data;
+        if (c->destroy != NULL && e->data != data) c->destroy(e->data);
+        e->data = data;
+        list_move_last(c->entries, it);
+        return 0;
+    }
+
+    if (c->max > 0 && (uint32_t)c->entries->count >= c->max) lru_evict(c);
+
+    struct lru_entry *e = malloc(sizeof(*e));
+    if (e == NULL) return -1;
+    memcpy(e->key, key, key_len);
+    e->key_len = key_len;
+    e->data = data;
+
+    if (list_insert(c->entries, e) == -1) {
+        free(e);
+        return -1;
+    }
+    if (hash_put(c->index, key, key_len, c->entries->last) == -1) {
+        list_remove_item(c->entries, c->entries->last);
+        free(e);
+        return -1;
+    }
+    return 0;
+}
+
+void lru_clear(struct lru *c) {
+    while (c->entries->count > 0) lru_remove(c, c->entries->first);
+}
+
+// Execute a function for each entry, from the least recently used
+void lru_fn(struct lru *c, void (*fn)(void *data, void *ctx), void *ctx) {
+    struct list_item *it = NULL;
+    for (it = c->entries->first; it != NULL; it = it->next) {
+        fn(((struct lru_entry *)it->data)->data, ctx);
+    }
+}
@@ -0,0 +1,78 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LRU_H__
+#define __LRU_H__
+
+#include <stdint.h>
+
+#include "hash.h"
+#include "list.h"
+
+#define LRU_KEY_MAX 20 // an IPv6 address and a few bytes more
+
+typedef void (*lru_destroy_fn)(void *data);
+
+// Tells whether an entry may be evicted, e.g. it is not referenced
+typedef int (*lru_evictable_fn)(const void *data);
+
+struct lru_entry {
+    uint8_t key[LRU_KEY_MAX];
+    uint32_t key_len;
+    void *data;
+};
+
+/* Bounded map from short binary keys to data. Lookups go through a hash
+ * table, entries are kept in a list from the least to the most recently
+ * used, and the least recently used one that is evictable makes room for
+ * a new one once max entries are held.
+ */
+struct lru {
+    struct hash *index; // key to the list item of the entry
+    struct list *entries;
+    uint32_t max;
+    lru_destroy_fn destroy;
+    lru_evictable_fn evictable;
+};
+
+struct lru *lru_create(uint32_t max, lru_destroy_fn destroy,
+                       lru_evictable_fn evictable);
+
+void lru_destroy(struct lru *c);
+
+void *lru_get(struct lru *c, const void *key, uint32_t key_len);
+
+void *lru_peek(const struct lru *c, const void *key, uint32_t key_len);
+
+int lru_put(struct lru *c, const void *key, uint32_t key_len, void *data);
+
+void lru_clear(struct lru *c);
+
+void lru_fn(struct lru *c, void (*fn)(void *data, void *ctx), void *ctx);
+
+#endif // __LRU_H__
@@ -69,6 +69,33 @@ static const uint8_t *get_inner6(const uint8_t *b, uint32_t blen) {
     return get_transport6(b + ICMPV6_H_SIZE, blen - ICMPV6_H_SIZE);
 }
 
+// The header quoted by an ICMP error must be of a probe to the same
+// destination, so concurrent measurements can reuse the same identifiers
+static int same_dst4(const uint8_t *p, const uint8_t *rlayer4) {
+    struct ipv4_hdr *pip = (struct ipv4_hdr *)(p + ETH_H_SIZE);
+    struct ipv4_hdr *inner = (struct ipv4_hdr *)(rlayer4 + ICMPV4_H_SIZE);
+    return pip->dst_addr == inner->dst_addr;
+}
+
+static int same_dst6(const uint8_t *p, const uint8_t *rlayer4) {
+    struct ipv6_hdr *pip = (struct ipv6_hdr *)(p + ETH_H_SIZE);
+    struct ipv6_hdr *inner = (struct ipv6_hdr *)(rlayer4 + ICMPV6_H_SIZE);
+    return memcmp(pip->dst_addr, inner->dst_addr, sizeof(pip->dst_addr)) == 0;
+}
+
+// An echo reply must come from the destination of the probe
+static int from_dst4(const uint8_t *p, const uint8_t *r) {
+    struct ipv4_hdr *pip = (struct ipv4_hdr *)(p + ETH_H_SIZE);
+    struct ipv4_hdr *rip = (struct ipv4_hdr *)(r + ETH_H_SIZE);
+    return pip->dst_addr == rip->src_addr;
+}
+
+static int from_dst6(const uint8_t *p, const uint8_t *r) {
+    struct ipv6_hdr *pip = (struct ipv6_hdr *)(p + ETH_H_SIZE);
+    struct ipv6_hdr *rip = (struct ipv6_hdr *)(r + ETH_H_SIZE);
+    return memcmp(pip->dst_addr, rip->src_addr, sizeof(pip->dst_addr)) == 0;
+}
+
 /* Match for ICMPv4 probe
  *
  */
@@ -84,12 +111,12 @@ int match_icmp4(const uint8_t *p, uint32_t plen,
 
     if (ricmp->type == ICMPV4_TYPE_EXCEEDED || ricmp->type == ICMPV4_TYPE_UNREACH) {
         struct icmpv4_hdr *inner = (struct icmpv4_hdr *)get_inner4(rlayer4, rlen);
-        if (picmp->body == inner->body) return 1;
+        if (picmp->body == inner->body && same_dst4(p, rlayer4)) return 1;
     }
 
     // Match an echo reply message
     if (ricmp->type == ICMPV4_TYPE_ECHOREPLY) {
-        if (picmp->body == ricmp->body) return 1;
+        if (picmp->body == ricmp->body && from_dst4(p, r)) return 1;
     }
 
     return 0;
@@ -110,12 +137,12 @@ int match_icmp6(const uint8_t *p, uint32_t plen,
 
     if (ricmp->type == ICMPV6_TYPE_EXCEEDED || ricmp->type == ICMPV6_TYPE_UNREACH) {
         struct icmpv6_hdr *inner = (struct icmpv6_hdr *)get_inner6(rlayer4, rlen);
-        if (picmp->body == inner->body) return 1;
+        if (picmp->body == inner->body && same_dst6(p, rlayer4)) return 1;
     }
 
     // Match an echo reply message
     if (ricmp->type == ICMPV6_TYPE_ECHOREPLY) {
-        if (picmp->body == ricmp->body) return 1;
+        if (picmp->body == ricmp->body && from_dst6(p, r)) return 1;
     }
 
     return 0;
@@ -138,7 +165,8 @@ int match_udp4(const uint8_t *p, uint32_t plen,
         struct udp_hdr *inner = (struct udp_hdr *)get_inner4(rlayer4, rlen);
         if (pudp->src_port == inner->src_port &&
             pudp->dst_port == inner->dst_port &&
-            pudp->checksum == inner->checksum) return 1;
+            pudp->checksum == inner->checksum &&
+            same_dst4(p, rlayer4)) return 1;
     }
 
     return 0;
@@ -161,7 +189,8 @@ int match_udp6(const uint8_t *p, uint32_t plen,
         struct udp_hdr *inner = (struct udp_hdr *)get_inner6(rlayer4, rlen);
         if (pudp->src_port == inner->src_port &&
             pudp->dst_port == inner->dst_port &&
-            pudp->checksum == inner->checksum) return 1;
+            pudp->checksum == inner->checksum &&
+            same_dst6(p, rlayer4)) return 1;
     }
 
     return 0;
@@ -186,7 +215,8 @@ int match_tcp4(const uint8_t *p, uint32_t plen,
             struct tcp_hdr *inner = (struct tcp_hdr *)get_inner4(rlayer4, rlen);
             if (ptcp->seq_numb == inner->seq_numb &&
                 ptcp->src_port == inner->src_port &&
-                ptcp->dst_port == inner->dst_port) return 1;
+                ptcp->dst_port == inner->dst_port &&
+                same_dst4(p, rlayer4)) return 1;
         }
     }
 
@@ -212,7 +242,8 @@ int match_tcp6(const uint8_t *p, uint32_t plen,
             struct tcp_hdr *inner = (struct tcp_hdr *)get_inner6(rlayer4, rlen);
             if (ptcp->seq_numb == inner->seq_numb &&
                 ptcp->src_port == inner->src_port &&
-                ptcp->dst_port == inner->dst_port) return 1;
+                ptcp->dst_port == inner->dst_port &&
+                same_dst6(p, rlayer4)) return 1;
         }
     }
 
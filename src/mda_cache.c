@@ -0,0 +1,147 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "mda_cache.h"
+
+/* The cache is a text file with one line per (flow id, TTL) pair:
+ *
+ *   <src> <dst> <flow-type> <ttl> <flow-id> <response> <response-type>
+ *
+ * Entries of every (src, dst, flow-type) key share the same file, so saving
+ * one key rewrites the file keeping the lines of the other keys.
+ */
+
+struct mda_cache_entry *mda_cache_entry_create(int ttl, uint16_t flow_id,
+                                               const char *response, int type) {
+    struct mda_cache_entry *e = malloc(sizeof(*e));
+    if (e == NULL) return NULL;
+    memset(e, 0, sizeof(*e));
+    e->ttl           = ttl;
+    e->flow_id       = flow_id;
+    e->response      = strdup(response);
+    e->response_type = type;
+    return e;
+}
+
+void mda_cache_entry_destroy(struct mda_cache_entry *e) {
+    free(e->response);
+    free(e);
+}
+
+static int mda_cache_parse(const char *line, char *src, char *dst,
+                           int *flow_type, int *ttl, int *flow_id,
+                           char *response, int *type) {
+    int r = sscanf(line, "%63s %63s %d %d %d %63s %d", src, dst, flow_type,
+                   ttl, flow_id, response, type);
+    if (r != 7) return -1;
+    if (*ttl < 1 || *ttl > 255 || *flow_id < 0 || *flow_id > 0xffff) return -1;
+    return 0;
+}
+
+struct list *mda_cache_load(const char *path, const char *src,
+                            const char *dst, int flow_type) {
+    struct list *entries = list_create();
+    if (entries == NULL) return NULL;
+
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return entries;
+
+    char line[MDA_CACHE_LINE];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char l_src[64], l_dst[64], l_resp[64];
+        int l_flow_type, l_ttl, l_flow_id, l_type;
+        if (mda_cache_parse(line, l_src, l_dst, &l_flow_type, &l_ttl,
+                            &l_flow_id, l_resp, &l_type) == -1) continue;
+
+        if (l_flow_type != flow_type || strcmp(l_src, src) != 0 ||
+            strcmp(l_dst, dst) != 0) continue;
+
+        struct mda_cache_entry *e = mda_cache_entry_create(l_ttl, l_flow_id,
+                                                           l_resp, l_type);
+        if (e != NULL) list_insert(entries, e);
+    }
+
+    fclose(f);
+    return entries;
+}
+
+int mda_cache_save(const char *path, const char *src, const char *dst,
+                   int flow_type, struct list *entries) {
+    // A truncated name could be the file itself, truncated by the open
+    char tmp_path[PATH_MAX];
+    int n = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (n < 0 || n >= (int)sizeof(tmp_path)) return -1;
+
+    FILE *out = fopen(tmp_path, "w");
+    if (out == NULL) return -1;
+
+    // Keep the lines of the other (src, dst, flow-type) keys
+    FILE *in = fopen(path, "r");
+    if (in != NULL) {
+        char line[MDA_CACHE_LINE];
+        while (fgets(line, sizeof(line), in) != NULL) {
+            char l_src[64], l_dst[64], l_resp[64];
+            int l_flow_type, l_ttl, l_flow_id, l_type;
+            if (mda_cache_parse(line, l_src, l_dst, &l_flow_type, &l_ttl,
+                                &l_flow_id, l_resp, &l_type) == -1) continue;
+
+            if (l_flow_type == flow_type && strcmp(l_src, src) == 0 &&
+                strcmp(l_dst, dst) == 0) continue;
+
+            fputs(line, out);
+        }
+        fclose(in);
+    }
+
+    struct list_item *it = NULL;
+    for (it = entries->first; it != NULL; it = it->next) {
+        struct mda_cache_entry *e = (struct mda_cache_entry *)it->data;
+        fprintf(out, "%s %s %d %d %d %s %d\n", src, dst, flow_type, e->ttl,
+                e->flow_id, e->response, e->response_type);
+    }
+
+    if (fclose(out) != 0) {
+        remove(tmp_path);
+        return -1;
+    }
+
+    return rename(tmp_path, path);
+}
+
+void mda_cache_destroy(struct list *entries) {
+    while (entries->count > 0) {
+        struct mda_cache_entry *e = (struct mda_cache_entry *)list_pop(entries);
+        mda_cache_entry_destroy(e);
+    }
+    list_destroy(entries);
+}
@@ -0,0 +1,59 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MDA_CACHE_H__
+#define __MDA_CACHE_H__
+
+#include <stdint.h>
+
+#include "list.h"
+
+#define MDA_CACHE_LINE 256
+
+// One flow id observed at a given TTL in a previous MDA run
+struct mda_cache_entry {
+    uint8_t ttl;
+    uint16_t flow_id;
+    char *response;
+    int response_type;
+};
+
+struct mda_cache_entry *mda_cache_entry_create(int ttl, uint16_t flow_id,
+                                               const char *response, int type);
+
+void mda_cache_entry_destroy(struct mda_cache_entry *e);
+
+struct list *mda_cache_load(const char *path, const char *src,
+                            const char *dst, int flow_type);
+
+int mda_cache_save(const char *path, const char *src, const char *dst,
+                   int flow_type, struct list *entries);
+
+void mda_cache_destroy(struct list *entries);
+
+#endif // __MDA_CACHE_H__
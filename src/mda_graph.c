@@ -0,0 +1,199 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mda_graph.h"
+
+#define MDA_GRAPH_KEY 64
+
+// Unresponsive interfaces are kept apart at each TTL, the other
+// addresses are the same vertex wherever they appear
+static int mda_graph_key(char *key, const char *addr, int ttl) {
+    if (strcmp(addr, "*") == 0) {
+        return snprintf(key, MDA_GRAPH_KEY, "*/%d", ttl);
+    }
+    return snprintf(key, MDA_GRAPH_KEY, "%s", addr);
+}
+
+struct mda_graph *mda_graph_create(FILE *out, const char *src,
+                                   const char *dst, int flow_type) {
+    struct mda_graph *g = malloc(sizeof(*g));
+    if (g == NULL) return NULL;
+    memset(g, 0, sizeof(*g));
+
+    g->out     = out;
+    g->index   = hash_create(0);
+    g->edges   = list_create();
+    g->pending = list_create();
+
+    if (g->index == NULL || g->edges == NULL || g->pending == NULL) {
+        mda_graph_destroy(g);
+        return NULL;
+    }
+
+    fprintf(g->out, "{\"type\":\"trace\",\"src\":\"%s\",\"dst\":\"%s\","
+            "\"flow_type\":%d}\n", src, dst, flow_type);
+    return g;
+}
+
+void mda_graph_destroy(struct mda_graph *g) {
+    if (g->edges != NULL) {
+        while (g->edges->count > 0) {
+            struct mda_edge *e = (struct mda_edge *)list_pop(g->edges);
+            free(e->flows);
+            free(e->rtts);
+            free(e);
+        }
+        list_destroy(g->edges);
+    }
+    if (g->pending != NULL) list_destroy(g->pending);
+    if (g->index != NULL) hash_destroy(g->index);
+
+    uint32_t i = 0;
+    for (i = 0; i < g->vertices_count; i++) {
+        free(g->vertices[i]->addr);
+        free(g->vertices[i]);
+    }
+    free(g->vertices);
+
+    if (g->out != NULL) fflush(g->out);
+    free(g);
+}
+
+uint32_t mda_graph_vertex(struct mda_graph *g, const char *addr, int ttl) {
+    char key[MDA_GRAPH_KEY];
+    int key_len = mda_graph_key(key, addr, ttl);
+
+    struct mda_vertex *v = hash_get(g->index, key, key_len);
+    if (v != NULL) return v->id;
+
+    if (g->vertices_count == g->vertices_alloc) {
+        uint32_t alloc = (g->vertices_alloc == 0) ? 64 : g->vertices_alloc * 2;
+        struct mda_vertex **vs = realloc(g->vertices, alloc * sizeof(*vs));
+        if (vs == NULL) return MDA_GRAPH_NO_VERTEX;
+        g->vertices = vs;
+        g->vertices_alloc = alloc;
+    }
+
+    v = malloc(sizeof(*v));
+    if (v == NULL) return MDA_GRAPH_NO_VERTEX;
+    v->id   = g->vertices_count;
+    v->addr = strdup(addr);
+    if (v->addr == NULL || hash_put(g->index, key, key_len, v) == -1) {
+        free(v->addr);
+        free(v);
+        return MDA_GRAPH_NO_VERTEX;
+    }
+    g->vertices[g->vertices_count++] = v;
+
+    fprintf(g->out, "{\"type\":\"vertex\",\"id\":%u,\"addr\":\"%s\"}\n",
+            v->id, v->addr);
+    return v->id;
+}
+
+static struct mda_edge *mda_graph_find_edge(struct mda_graph *g, int ttl,
+                                            uint32_t from, uint32_t to) {
+    struct list_item *it = NULL;
+    for (it = g->pending->first; it != NULL; it = it->next) {
+        struct mda_edge *e = (struct mda_edge *)it->data;
+        if (e->ttl == ttl && e->from == from && e->to == to) return e;
+    }
+    return NULL;
+}
+
+// Add the flow to the edge between `from` at `ttl` and `to` at `ttl` + 1,
+// a flow seen again, e.g. retried or verified from the cache, is kept once
+int mda_graph_edge(struct mda_graph *g, int ttl, const char *from,
+                   const char *to, uint16_t flow_id, struct timespec rtt) {
+    uint32_t from_id = mda_graph_vertex(g, from, ttl);
+    uint32_t to_id   = mda_graph_vertex(g, to, ttl + 1);
+    if (from_id == MDA_GRAPH_NO_VERTEX || to_id == MDA_GRAPH_NO_VERTEX) {
+        return -1;
+    }
+
+    struct mda_edge *e = mda_graph_find_edge(g, ttl, from_id, to_id);
+    if (e == NULL) {
+        e = malloc(sizeof(*e));
+        if (e == NULL) return -1;
+        memset(e, 0, sizeof(*e));
+        e->ttl  = ttl;
+        e->from = from_id;
+        e->to   = to_id;
+        list_insert(g->edges, e);
+        list_insert(g->pending, e);
+    }
+
+    uint32_t i = 0;
+    for (i = 0; i < e->count; i++) {
+        if (e->flows[i] == flow_id) return 0;
+    }
+
+    if (e->count == e->alloc) {
+        uint32_t alloc = (e->alloc == 0) ? 8 : e->alloc * 2;
+        uint16_t *flows = realloc(e->flows, alloc * sizeof(*flows));
+        if (flows == NULL) return -1;
+        e->flows = flows;
+        struct timespec *rtts = realloc(e->rtts, alloc * sizeof(*rtts));
+        if (rtts == NULL) return -1;
+        e->rtts = rtts;
+        e->alloc = alloc;
+    }
+
+    e->flows[e->count] = flow_id;
+    e->rtts[e->count]  = rtt;
+    e->count++;
+    return 0;
+}
+
+// Write the edges added since the last call, `per_packet` tells if their
+// source vertex balances traffic per packet
+void mda_graph_flush(struct mda_graph *g, int per_packet) {
+    while (g->pending->count > 0) {
+        struct mda_edge *e = (struct mda_edge *)list_pop(g->pending);
+        e->per_packet = per_packet;
+
+        fprintf(g->out, "{\"type\":\"edge\",\"ttl\":%d,\"from\":%u,\"to\":%u,"
+                "\"per_packet\":%s,\"flows\":[", e->ttl, e->from, e->to,
+                (e->per_packet == 1) ? "true" : "false");
+
+        uint32_t i = 0;
+        for (i = 0; i < e->count; i++) {
+            fprintf(g->out, "%s%u", (i > 0) ? "," : "", e->flows[i]);
+        }
+
+        fprintf(g->out, "],\"rtt\":[");
+        for (i = 0; i < e->count; i++) {
+            double rtt = e->rtts[i].tv_sec * 1000.0 + e->rtts[i].tv_nsec / 1e6;
+            fprintf(g->out, "%s%.3f", (i > 0) ? "," : "", rtt);
+        }
+        fprintf(g->out, "]}\n");
+    }
+    fflush(g->out);
+}
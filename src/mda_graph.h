@@ -0,0 +1,82 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MDA_GRAPH_H__
+#define __MDA_GRAPH_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "hash.h"
+#include "list.h"
+
+#define MDA_GRAPH_NO_VERTEX UINT32_MAX
+
+struct mda_vertex {
+    uint32_t id;
+    char *addr;
+};
+
+struct mda_edge {
+    uint8_t ttl;
+    uint32_t from;
+    uint32_t to;
+    int per_packet;
+    uint32_t count;
+    uint32_t alloc;
+    uint16_t *flows;
+    struct timespec *rtts;
+};
+
+// Diamond discovered by MDA, with addresses interned to vertex ids. Each
+// vertex and edge is written as a JSON line as soon as it is complete.
+struct mda_graph {
+    FILE *out;
+    struct hash *index;
+    struct mda_vertex **vertices;
+    uint32_t vertices_count;
+    uint32_t vertices_alloc;
+    struct list *edges;
+    struct list *pending;
+};
+
+struct mda_graph *mda_graph_create(FILE *out, const char *src,
+                                   const char *dst, int flow_type);
+
+void mda_graph_destroy(struct mda_graph *g);
+
+// Returns MDA_GRAPH_NO_VERTEX when the vertex could not be added
+uint32_t mda_graph_vertex(struct mda_graph *g, const char *addr, int ttl);
+
+int mda_graph_edge(struct mda_graph *g, int ttl, const char *from,
+                   const char *to, uint16_t flow_id, struct timespec rtt);
+
+void mda_graph_flush(struct mda_graph *g, int per_packet);
+
+#endif // __MDA_GRAPH_H__
@@ -0,0 +1,212 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
+
+#include "lru.h"
+#include "route.h"
+#include "mt_nd.h"
+#include "monitor.h"
+
+// Receive buffer, notifications are small but come in bursts
+#define MONITOR_BUF 16384
+
+struct monitor *monitor_create(void) {
+    struct monitor *m = malloc(sizeof(*m));
+    if (m == NULL) return NULL;
+    memset(m, 0, sizeof(*m));
+
+    m->fd = socket(PF_NETLINK, SOCK_RAW | SOCK_NONBLOCK, NETLINK_ROUTE);
+    if (m->fd == -1) goto fail;
+
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = RTMGRP_LINK | RTMGRP_NEIGH | RTMGRP_IPV4_ROUTE |
+                   RTMGRP_IPV6_ROUTE | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (bind(m->fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) goto fail;
+    return m;
+
+fail:
+    if (m->fd != -1) close(m->fd);
+    free(m);
+    return NULL;
+}
+
+void monitor_destroy(struct monitor *m) {
+    close(m->fd);
+    free(m);
+}
+
+// Routes are added to the trie as they come, but a deleted one may have
+// hidden another for the same prefix, so the table is dumped again on
+// the next lookup
+static void monitor_route(struct mt *a, struct nlmsghdr *msg) {
+    lru_clear(a->routes);
+
+    if (msg->nlmsg_type == RTM_NEWROUTE && a->route_table != NULL) {
+        route_table_add(a->route_table, msg);
+        return;
+    }
+
+    if (a->route_table != NULL) route_table_destroy(a->route_table);
+    a->route_table = NULL;
+    a->route_table_stale = 1;
+}
+
+static struct neighbor *monitor_find_neighbor(struct mt *a, int family,
+                                              const uint8_t *ip_addr,
+                                              int if_index) {
+    int len = (family == AF_INET) ? ADDR_IPV4_SIZE : ADDR_IPV6_SIZE;
+    struct neighbor *n = lru_peek(a->neighbors, ip_addr, len);
+    if (n == NULL || n->if_index != if_index) return NULL;
+    return n;
+}
+
+static void monitor_stale(void *data, void *ctx) {
+    struct neighbor *n = (struct neighbor *)data;
+    if (ctx == NULL || n->if_index == *(int *)ctx) n->stale = 1;
+}
+
+// Destinations point at the hardware address of their neighbor, so a new
+// one is copied in place; a neighbor that is gone or not MT_ND_VALID,
+// e.g. STALE, is resolved again by the next destination that needs it
+static void monitor_neigh(struct mt *a, struct nlmsghdr *msg) {
+    struct ndmsg *ndmsg = NLMSG_DATA(msg);
+    if (ndmsg->ndm_family != AF_INET && ndmsg->ndm_family != AF_INET6) return;
+
+    const uint8_t *dst = NULL;
+    const uint8_t *lladdr = NULL;
+    int len = msg->nlmsg_len - NLMSG_LENGTH(sizeof(*ndmsg));
+    struct rtattr *rta = NULL;
+    for (rta = (struct rtattr *)((uint8_t *)ndmsg + NLMSG_ALIGN(sizeof(*ndmsg)));
+         RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == NDA_DST) {
+            dst = RTA_DATA(rta);
+        } else if (rta->rta_type == NDA_LLADDR &&
+                   RTA_PAYLOAD(rta) == ADDR_ETH_SIZE) {
+            lladdr = RTA_DATA(rta);
+        }
+    }
+    if (dst == NULL) return;
+
+    struct neighbor *n = monitor_find_neighbor(a, ndmsg->ndm_family, dst,
+                                               ndmsg->ndm_ifindex);
+    if (n == NULL) return;
+
+    if (msg->nlmsg_type == RTM_NEWNEIGH && lladdr != NULL &&
+        (ndmsg->ndm_state & MT_ND_VALID) != 0) {
+        memcpy(n->hw_addr->addr, lladdr, ADDR_ETH_SIZE);
+        n->stale = 0;
+    } else {
+        n->stale = 1;
+    }
+}
+
+static void monitor_link(struct mt *a, struct nlmsghdr *msg) {
+    struct ifinfomsg *ifi = NLMSG_DATA(msg);
+    a->ifaces_stale = 1;
+
+    const uint8_t *hw_addr = NULL;
+    int len = msg->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+    struct rtattr *rta = NULL;
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_ADDRESS && RTA_PAYLOAD(rta) == ADDR_ETH_SIZE) {
+            hw_addr = RTA_DATA(rta);
+        }
+    }
+
+    struct list_item *it = NULL;
+    for (it = a->interfaces->first; it != NULL; it = it->next) {
+        struct interface *i = (struct interface *)it->data;
+        if (i->if_index != ifi->ifi_index) continue;
+        if (hw_addr != NULL && i->hw_addr != NULL) {
+            memcpy(i->hw_addr->addr, hw_addr, ADDR_ETH_SIZE);
+        }
+    }
+
+    // The neighbors of an interface that went away or down are not to be
+    // trusted when it comes back
+    if (msg->nlmsg_type == RTM_DELLINK || (ifi->ifi_flags & IFF_UP) == 0) {
+        lru_fn(a->neighbors, &monitor_stale, &ifi->ifi_index);
+    }
+}
+
+// Drops every cached entry, after notifications were lost
+static void monitor_reset(struct mt *a) {
+    lru_fn(a->neighbors, &monitor_stale, NULL);
+    lru_clear(a->routes);
+    if (a->route_table != NULL) route_table_destroy(a->route_table);
+    a->route_table = NULL;
+    a->route_table_stale = 1;
+    a->ifaces_stale = 1;
+}
+
+// Applies the pending notifications without blocking, returns how many
+int monitor_poll(struct monitor *m, struct mt *a) {
+    uint8_t buf[MONITOR_BUF];
+    int count = 0;
+
+    while (1) {
+        int len = recv(m->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (len < 0 && errno == ENOBUFS) {
+            monitor_reset(a);
+            continue;
+        }
+        if (len <= 0) break;
+
+        struct nlmsghdr *msg = (struct nlmsghdr *)buf;
+        for (; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+            if (msg->nlmsg_type == RTM_NEWROUTE ||
+                msg->nlmsg_type == RTM_DELROUTE) {
+                monitor_route(a, msg);
+            } else if (msg->nlmsg_type == RTM_NEWNEIGH ||
+                       msg->nlmsg_type == RTM_DELNEIGH) {
+                monitor_neigh(a, msg);
+            } else if (msg->nlmsg_type == RTM_NEWLINK ||
+                       msg->nlmsg_type == RTM_DELLINK) {
+                monitor_link(a, msg);
+            } else if (msg->nlmsg_type == RTM_NEWADDR ||
+                       msg->nlmsg_type == RTM_DELADDR) {
+                a->ifaces_stale = 1;
+            } else {
+                continue;
+            }
+            count++;
+        }
+    }
+    return count;
+}
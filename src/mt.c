@@ -35,30 +35,77 @@
 #include "dst.h"
 #include "iface.h"
 #include "util.h"
+#include "fanout.h"
+#include "hash.h"
 #include "link.h"
+#include "lru.h"
+#include "pdu_eth.h"
+#include "raw_recv.h"
+#include "rto.h"
+#include "monitor.h"
 #include "args.h"
 #include "mt.h"
 #include "mt_nd.h"
 #include "mt_mda.h"
 #include "mt_ping.h"
+#include "mt_sweep.h"
 #include "mt_traceroute.h"
+#include "sched.h"
+#include "stop_set.h"
 
 #define MT_MDA        1
 #define MT_PING       2
 #define MT_TRACEROUTE 3
 
+#define MT_ROUTES_MAX 1024
+#define MT_NEIGHBORS_MAX 4096
+
+// Linux cooked capture header, of ppp links among others
+#define MT_SLL_H_SIZE 16
+#define MT_BATCH_LINE 256
+
+// Lines of the input read ahead to resolve their neighbors together
+#define MT_BATCH_AHEAD 64
+
+// Longest sleep while waiting for neighbor replies, in microseconds
+#define MT_ND_IDLE_US 1000
+
+// Sleep between checks of probes that fanout threads are matching
+#define MT_FANOUT_IDLE_US 1000
+
+static int interface_pcap_open(struct interface *i, int l3);
+
+// Fanout threads match replies against the probes of their shard, which
+// are only read and changed with the shard locked
+static void mt_lock(struct interface *i, const struct probe *p) {
+    if (i->fanout != NULL) fanout_lock(i->fanout, p);
+}
+
+static void mt_unlock(struct interface *i, const struct probe *p) {
+    if (i->fanout != NULL) fanout_unlock(i->fanout, p);
+}
+
 struct probe *mt_send(struct mt *a, int if_index, const uint8_t *buf,
                       uint32_t len, match_fn fn) {
     struct interface *i = mt_get_interface(a, if_index);
     struct probe *p = probe_create(buf, len, fn);
+    pthread_mutex_lock(&a->rto_lock);
+    p->timeout = rto_timeout(a->rto, p);
+    pthread_mutex_unlock(&a->rto_lock);
+
+    // Indexed before it is sent, so no reply arrives ahead of it
+    mt_lock(i, p);
+    if (i->fanout != NULL) fanout_add(i->fanout, p);
     link_write(i->link, p->probe, p->probe_len, &(p->sent_time));
+    p->last_sent_time = p->sent_time;
+    mt_unlock(i, p);
     list_insert(i->probes, p);
 
-    if (a->probes_count > 0) {
-        struct timespec elapsed = timespec_diff_now(&a->last_probe_time);
+    if (i->probes_count > 0) {
+        struct timespec elapsed = timespec_diff_now(&i->last_probe_time);
         if (timespec_cmp(&elapsed, &a->send_wait) == -1) {
             struct timespec remaining = timespec_diff(&a->send_wait, &elapsed);
-            usleep(timespec_to_ms(&remaining) * 1000);
+            nanosleep(&remaining, NULL);
         }
     }
 
@@ -67,148 +114,604 @@ struct probe *mt_send(struct mt *a, int if_index, const uint8_t *buf,
     }
     a->probes_count++;
     clock_gettime(CLOCK_REALTIME, &a->last_probe_time);
+    i->probes_count++;
+    i->last_probe_time = a->last_probe_time;
     return p;
 }
 
+// The probe is waited for the whole probe timeout and never sent again, a
+// resend would hide a loss and measure the RTT of a late answer short
+void mt_send_once(struct mt *a, struct probe *p) {
+    p->once = 1;
+    p->timeout = timespec_from_ms(a->probe_timeout * 1000);
+}
+
+int mt_send_raw(struct mt *a, int if_index, const uint8_t *buf, uint32_t len) {
+    struct interface *i = mt_get_interface(a, if_index);
+    struct timespec t;
+    if (link_write(i->link, (uint8_t *)buf, len, &t) < 0) return -1;
+
+    if (a->probes_count == 0) a->first_probe_time = t;
+    a->probes_count++;
+    a->last_probe_time = t;
+    i->probes_count++;
+    i->last_probe_time = t;
+    return 0;
+}
+
 static void mt_retry(struct mt *a, struct interface *i, struct probe *p) {
-    link_write(i->link, p->probe, p->probe_len, &(p->sent_time));
+    link_write(i->link, p->probe, p->probe_len, &(p->last_sent_time));
     p->retries++;
+    pthread_mutex_lock(&a->rto_lock);
+    rto_backoff(a->rto, p);
+    pthread_mutex_unlock(&a->rto_lock);
+}
+
+static void mt_rto_update(struct mt *a, struct probe *p) {
+    pthread_mutex_lock(&a->rto_lock);
+    rto_update(a->rto, p);
+    pthread_mutex_unlock(&a->rto_lock);
+}
+
+// Called by the fanout threads with the probe locked
+static void mt_fanout_match(struct probe *p, void *ctx) {
+    mt_rto_update((struct mt *)ctx, p);
 }
 
-static void mt_receive(struct interface *i, const uint8_t *buf,
+static void mt_receive(struct mt *a, struct interface *i, const uint8_t *buf,
                        uint32_t len, struct timespec ts) {
     struct list_item *it;
     for (it = i->probes->first; it != NULL; it = it->next) {
         struct probe *p = (struct probe *)it->data;
         if (p->sent_time.tv_sec > 0 && p->response_len == 0) {
-            probe_match(p, buf, len, &ts);
+            if (probe_match(p, buf, len, &ts) == 1) mt_rto_update(a, p);
         }
     }
 }
 
+static int mt_retries(const struct mt *a, const struct probe *p) {
+    return (p->once) ? 0 : a->retries;
+}
+
+// Whether a probe is still unanswered, sending it again once it times out
+static int mt_unanswered(struct mt *a, struct interface *i, struct probe *p) {
+    if (p->fn == NULL || p->expired) return 0;
+    if (p->response_len > 0) return 0;
+    if (probe_timeout(p) == 0) return 1;
+    if (p->retries >= mt_retries(a, p)) {
+        p->expired = 1;
+        pthread_mutex_lock(&a->rto_lock);
+        rto_expire(a->rto, p);
+        pthread_mutex_unlock(&a->rto_lock);
+        return 0;
+    }
+    mt_retry(a, i, p);
+    return 1;
+}
+
 static int mt_unanswered_probes(struct mt *a, struct interface *i) {
     struct list_item *it;
     int count = 0;
     for (it = i->probes->first; it != NULL; it = it->next) {
         struct probe *p = (struct probe *)it->data;
-        if (p->fn == NULL) continue;
-        if (p->response_len > 0) continue;
-        if (probe_timeout(p, a->probe_timeout) == 0) {
-            count++;
-            continue;
-        }
-        if (p->retries == a->retries) continue;        
-        mt_retry(a, i, p);
-        count++;
+        mt_lock(i, p);
+        count += mt_unanswered(a, i, p);
+        mt_unlock(i, p);
     }
     return count;
 }
 
 void mt_wait(struct mt *a, int if_index) {
+    mt_wait_fn(a, if_index, NULL, NULL);
+}
+
+/* Captures are handed on as Ethernet frames, the format probes are built
+ * and matched in. Links without Ethernet framing, which only an L3 link
+ * sends on, get a header with the EtherType of their IP version.
+ */
+static const uint8_t *mt_frame(struct interface *i, const uint8_t *pkt,
+                               uint32_t *len) {
+    if (i->datalink == DLT_EN10MB) return pkt;
+
+    uint32_t skip = 0;
+    if (i->datalink == DLT_LINUX_SLL) skip = MT_SLL_H_SIZE;
+    if (*len <= skip || *len - skip > MT_PCAP_SNAPLEN) return NULL;
+
+    uint8_t version = pkt[skip] >> 4;
+    uint16_t type = 0;
+    if (version == 4) type = htons(ETH_TYPE_IPV4);
+    else if (version == 6) type = htons(ETH_TYPE_IPV6);
+    else return NULL;
+
+    struct eth_hdr *eth = (struct eth_hdr *)i->frame;
+    memset(eth, 0, sizeof(*eth));
+    eth->type = type;
+    memcpy(i->frame + ETH_H_SIZE, pkt + skip, *len - skip);
+    *len = *len - skip + ETH_H_SIZE;
+    return i->frame;
+}
+
+struct mt_dispatch_ctx {
+    struct interface *i;
+    mt_receive_fn fn;
+    void *ctx;
+};
+
+static void mt_dispatch_handler(u_char *user, const struct pcap_pkthdr *h,
+                                const u_char *bytes) {
+    struct mt_dispatch_ctx *d = (struct mt_dispatch_ctx *)user;
+    struct timespec ts;
+    ts.tv_sec = h->ts.tv_sec;
+    ts.tv_nsec = h->ts.tv_usec * 1000;
+    uint32_t len = h->caplen;
+    const uint8_t *frame = mt_frame(d->i, (const uint8_t *)bytes, &len);
+    if (frame != NULL) d->fn(frame, len, &ts, d->ctx);
+}
+
+static int mt_pcap_dispatch(struct interface *i, mt_receive_fn fn,
+                            void *ctx) {
+    if (i->pcap_handle == NULL) return 0;
+    struct mt_dispatch_ctx d = { i, fn, ctx };
+    char pcap_error[PCAP_ERRBUF_SIZE];
+    pcap_setnonblock(i->pcap_handle, 1, pcap_error);
+    int n = pcap_dispatch(i->pcap_handle, -1, &mt_dispatch_handler, (u_char *)&d);
+    pcap_setnonblock(i->pcap_handle, 0, pcap_error);
+    return n;
+}
+
+// Replies come from the raw sockets, waiting up to timeout_ms for them.
+// pcap is left with ARP, which is not IP.
+static int mt_raw_dispatch(struct interface *i, int timeout_ms,
+                           mt_receive_fn fn, void *ctx) {
+    int n = raw_recv_dispatch(i->raw_recv, timeout_ms, fn, ctx);
+    return n + mt_pcap_dispatch(i, fn, ctx);
+}
+
+struct mt_pending {
+    struct mt *a;
+    struct interface *i;
+};
+
+static void mt_receive_pending(const uint8_t *buf, uint32_t len,
+                               const struct timespec *ts, void *ctx) {
+    struct mt_pending *pending = (struct mt_pending *)ctx;
+    mt_receive(pending->a, pending->i, buf, len, *ts);
+}
+
+void mt_wait_fn(struct mt *a, int if_index, mt_done_fn done, void *ctx) {
     struct interface *i = mt_get_interface(a, if_index);
+    struct mt_pending pending = { a, i };
     while (mt_unanswered_probes(a, i) > 0) {
+        if (done != NULL && done(a, i, ctx) == 1) break;
+        if (i->fanout != NULL) {
+            usleep(MT_FANOUT_IDLE_US);
+            continue;
+        }
+        if (i->raw_recv != NULL) {
+            mt_raw_dispatch(i, MT_PCAP_MS, &mt_receive_pending, &pending);
+            continue;
+        }
         struct pcap_pkthdr *header;
         const u_char *pkt_data;
         if (pcap_next_ex(i->pcap_handle, &header, &pkt_data) > 0) {
             struct timespec ts;
             ts.tv_sec = header->ts.tv_sec;
             ts.tv_nsec = header->ts.tv_usec * 1000;
-            mt_receive(i, (uint8_t *)pkt_data, header->caplen, ts);
+            uint32_t len = header->caplen;
+            const uint8_t *frame = mt_frame(i, pkt_data, &len);
+            if (frame != NULL) mt_receive(a, i, frame, len, ts);
+        }
+    }
+}
+
+int mt_dispatch(struct mt *a, int if_index, mt_receive_fn fn, void *ctx) {
+    struct interface *i = mt_get_interface(a, if_index);
+    // Fanout threads take the replies to probes, frames for other uses,
+    // e.g. sweeps, are captured as without them
+    if (i->fanout != NULL && i->pcap_handle == NULL) {
+        interface_pcap_open(i, a->l3);
+    }
+    if (i->raw_recv != NULL) return mt_raw_dispatch(i, 0, fn, ctx);
+    return mt_pcap_dispatch(i, fn, ctx);
+}
+
+int mt_poll(struct mt *a, int if_index) {
+    struct interface *i = mt_get_interface(a, if_index);
+    struct mt_pending pending = { a, i };
+    if (i->fanout == NULL) mt_dispatch(a, if_index, &mt_receive_pending, &pending);
+    return mt_unanswered_probes(a, i);
+}
+
+static int mt_probe_cmp(const void *a, const void *b) {
+    return a != b;
+}
+
+// A probe is pending while it is unanswered and may still be answered
+static int mt_probe_pending(const struct mt *a, const struct probe *p) {
+    if (p->response_len > 0 || p->fn == NULL) return 0;
+    return probe_timeout(p) == 0 || p->retries < mt_retries(a, p);
+}
+
+// Takes the probe out of its shard too, unless it is still pending
+static struct probe *mt_remove_done(struct mt *a, struct interface *i,
+                                    struct list_item *it) {
+    struct probe *p = (struct probe *)it->data;
+    mt_lock(i, p);
+    int pending = mt_probe_pending(a, p);
+    if (!pending && i->fanout != NULL) fanout_remove(i->fanout, p);
+    mt_unlock(i, p);
+    if (pending) return NULL;
+    return (struct probe *)list_remove_item(i->probes, it);
+}
+
+struct probe *mt_pop_probe(struct mt *a, int if_index) {
+    struct interface *i = mt_get_interface(a, if_index);
+    struct list_item *it = NULL;
+    struct probe *p = NULL;
+    for (it = i->probes->first; it != NULL && p == NULL; it = it->next) {
+        p = mt_remove_done(a, i, it);
+    }
+    return p;
+}
+
+// Moves every probe that is no longer pending to done, in a single pass
+int mt_pop_probes(struct mt *a, int if_index, struct list *done) {
+    struct interface *i = mt_get_interface(a, if_index);
+    struct list_item *it = i->probes->first;
+    int count = 0;
+    while (it != NULL) {
+        struct list_item *next = it->next;
+        struct probe *p = mt_remove_done(a, i, it);
+        if (p != NULL) {
+            list_insert(done, p);
+            count++;
+        }
+        it = next;
+    }
+    return count;
+}
+
+// Takes a probe out of its interface whether it is pending or not
+static void mt_take_probe(struct mt *a, int if_index, struct probe *p) {
+    struct interface *i = mt_get_interface(a, if_index);
+    struct list_item *it = list_find(i->probes, p, &mt_probe_cmp);
+    if (it == NULL) return;
+    mt_lock(i, p);
+    if (i->fanout != NULL) fanout_remove(i->fanout, p);
+    mt_unlock(i, p);
+    list_remove_item(i->probes, it);
+}
+
+static int mt_probe_done(struct mt *a, struct interface *i, void *ctx) {
+    const struct probe *p = (const struct probe *)ctx;
+    mt_lock(i, p);
+    int done = !mt_probe_pending(a, p);
+    mt_unlock(i, p);
+    return done;
+}
+
+// Waits for a single probe and takes it out of the interface, leaving the
+// probes of other measurements in place
+void mt_wait_probe(struct mt *a, int if_index, struct probe *p) {
+    mt_wait_fn(a, if_index, &mt_probe_done, p);
+    mt_take_probe(a, if_index, p);
+}
+
+// Tells whether the send wait of the interface has passed
+int mt_send_ready(struct mt *a, int if_index) {
+    struct interface *i = mt_get_interface(a, if_index);
+    if (i == NULL || i->probes_count == 0) return 1;
+    struct timespec elapsed = timespec_diff_now(&i->last_probe_time);
+    return timespec_cmp(&elapsed, &a->send_wait) != -1;
+}
+
+// Applies the route, neighbor and link changes the kernel announced
+void mt_refresh(struct mt *a) {
+    if (a->monitor != NULL) monitor_poll(a->monitor, a);
+}
+
+static struct iface_table *mt_ifaces(struct mt *a) {
+    if (a->ifaces_stale) {
+        if (a->ifaces != NULL) iface_table_destroy(a->ifaces);
+        a->ifaces = iface_table_create();
+        a->ifaces_stale = 0;
+    }
+    return a->ifaces;
+}
+
+// Served from the interface table, which is read again after the kernel
+// announces a link or address change
+struct addr *mt_iface_hw_addr(struct mt *a, int if_index) {
+    struct iface_table *t = mt_ifaces(a);
+    struct addr *addr = (t != NULL) ? iface_table_hw_addr(t, if_index) : NULL;
+    return (addr != NULL) ? addr : iface_hw_addr(if_index);
+}
+
+struct addr *mt_iface_ip_addr(struct mt *a, int if_index, int type) {
+    struct iface_table *t = mt_ifaces(a);
+    struct addr *addr = (t != NULL) ? iface_table_ip_addr(t, if_index, type)
+                                    : NULL;
+    return (addr != NULL) ? addr : iface_ip_addr(if_index, type);
+}
+
+// The preferred source of the route when the kernel set one, as long as
+// the interface still has it, else an address of the interface
+struct addr *mt_iface_src_addr(struct mt *a, const struct route *r, int type) {
+    if (r->prefsrc == NULL || r->prefsrc->type != type) {
+        return mt_iface_ip_addr(a, r->if_index, type);
+    }
+
+    struct iface_table *t = mt_ifaces(a);
+    if (t == NULL) return addr_copy(r->prefsrc);
+
+    const struct list *addrs = iface_table_ip_addrs(t, r->if_index);
+    struct list_item *it = NULL;
+    for (it = (addrs != NULL) ? addrs->first : NULL; it != NULL; it = it->next) {
+        const struct addr *addr = (const struct addr *)it->data;
+        if (addr->type == type && addr_cmp(addr, r->prefsrc) == 0) {
+            return addr_copy(addr);
         }
     }
+    return mt_iface_ip_addr(a, r->if_index, type);
 }
 
+// The FIB dumped at start answers most lookups, single RTM_GETROUTE
+// requests cover the rest, e.g. if the dump failed
 struct route *mt_get_route(struct mt *a, const struct addr *dst) {
-    struct list_item *i = NULL;
-    for (i = a->routes->first; i != NULL; i = i->next) {
-        struct route *r = (struct route *)i->data;
-        int dst_size = (dst->type == ADDR_IPV4) ? ADDR_IPV4_SIZE : ADDR_IPV6_SIZE;
-        if (buff_cmp(dst->addr, r->dst->addr, dst_size) == 0) return r;
+    if (a->route_table == NULL && a->route_table_stale) {
+        a->route_table = route_table_create();
+        a->route_table_stale = 0;
+    }
+    if (a->route_table != NULL) {
+        struct route *r = route_table_lookup(a->route_table, dst);
+        if (r != NULL) return (r->if_index > 0) ? r : NULL;
     }
-    struct route *r = route_create(dst);
+
+    int dst_size = (dst->type == ADDR_IPV4) ? ADDR_IPV4_SIZE : ADDR_IPV6_SIZE;
+    struct route *r = lru_get(a->routes, dst->addr, dst_size);
+    if (r != NULL) return r;
+
+    r = route_create(dst);
     if (r == NULL) return NULL;
-    list_insert(a->routes, r);
+
+    // Bounded for long runs, dsts do not keep their route
+    if (lru_put(a->routes, dst->addr, dst_size, r) == -1) {
+        route_destroy(r);
+        return NULL;
+    }
+    return r;
+}
+
+// Links without Ethernet framing are only probed through raw IP sockets
+static int interface_datalink_ok(int datalink, int l3) {
+    if (datalink == DLT_EN10MB) return 1;
+    return l3 && (datalink == DLT_RAW || datalink == DLT_LINUX_SLL);
+}
+
+// With raw socket receives, the capture only has to see ARP replies
+static int interface_pcap_filter(struct interface *i) {
+    struct bpf_program prog;
+    if (pcap_compile(i->pcap_handle, &prog, "arp", 1,
+                     PCAP_NETMASK_UNKNOWN) != 0) return -1;
+    int r = pcap_setfilter(i->pcap_handle, &prog);
+    pcap_freecode(&prog);
     return r;
 }
 
-static int interface_pcap_open(struct interface *i) {
+static int interface_pcap_open(struct interface *i, int l3) {
     char pcap_error[PCAP_ERRBUF_SIZE];
     i->pcap_handle = pcap_open_live(i->if_name, MT_PCAP_SNAPLEN,
                                     MT_PCAP_PROMISC, MT_PCAP_MS,
                                     pcap_error);
 
     if (i->pcap_handle == NULL) goto fail;
-    if (pcap_datalink(i->pcap_handle) != DLT_EN10MB) goto fail;
+    i->datalink = pcap_datalink(i->pcap_handle);
+    if (!interface_datalink_ok(i->datalink, l3)) goto fail;
     if (pcap_setdirection(i->pcap_handle, PCAP_D_IN) != 0) goto fail;
+    if (i->raw_recv != NULL && interface_pcap_filter(i) != 0) goto fail;
+    if (i->datalink != DLT_EN10MB) {
+        i->frame = malloc(MT_PCAP_SNAPLEN + ETH_H_SIZE);
+        if (i->frame == NULL) goto fail;
+    }
     return 0;
 
 fail:
-    pcap_close(i->pcap_handle);
+    if (i->pcap_handle != NULL) pcap_close(i->pcap_handle);
+    i->pcap_handle = NULL;
     return -1;
 }
 
 struct interface *mt_get_interface(struct mt *a, int if_index) {
-    struct list_item *it = NULL;
-    for (it = a->interfaces->first; it != NULL; it = it->next) {
-        struct interface *interface = (struct interface *)it->data;
-        if (interface->if_index == if_index) return interface;
-    }
+    struct interface *interface = hash_get(a->interface_index, &if_index,
+                                           sizeof(if_index));
+    if (interface != NULL) return interface;
 
     struct interface *i = malloc(sizeof(*i));
     if (i == NULL) return NULL;
     memset(i, 0, sizeof(*i));
     i->if_index = if_index;
     if_indextoname(if_index, i->if_name);
-    i->hw_addr = iface_hw_addr(if_index);
-    i->link = link_open(if_index);
+    i->hw_addr = mt_iface_hw_addr(a, if_index);
+    i->link = (a->l3) ? link_open_l3(if_index) : link_open(if_index);
     i->probes = list_create();
     if (i->probes == NULL) return NULL;
-    interface_pcap_open(i);
+    if (a->fanout > 0) {
+        i->fanout = fanout_open(if_index, a->fanout, &mt_fanout_match, a);
+        if (i->fanout == NULL) {
+            printf("could not open the receive fanout on %s\n", i->if_name);
+        }
+    }
+    if (a->raw_recv && i->fanout == NULL) i->raw_recv = raw_recv_open(if_index);
+    if (i->fanout == NULL) interface_pcap_open(i, a->l3);
 
     list_insert(a->interfaces, i);
+    hash_put(a->interface_index, &if_index, sizeof(if_index), i);
     return i;
 }
 
 static void mt_interface_destroy(struct interface *i) {
+    if (i->fanout != NULL) fanout_close(i->fanout);
     while (i->probes->count > 0) {
         struct probe *p = (struct probe *)list_pop(i->probes);
         probe_destroy(p);
     }
     list_destroy(i->probes);
     link_close(i->link);
-    pcap_close(i->pcap_handle);
+    if (i->pcap_handle != NULL) pcap_close(i->pcap_handle);
+    raw_recv_close(i->raw_recv);
     addr_destroy(i->hw_addr);
+    free(i->frame);
     free(i);
 }
 
+static struct neighbor *mt_find_neighbor(struct mt *a,
+                                         const struct addr *dst) {
+    int dst_size = (dst->type == ADDR_IPV4) ? ADDR_IPV4_SIZE : ADDR_IPV6_SIZE;
+    return lru_get(a->neighbors, dst->addr, dst_size);
+}
+
+// Caches a resolved neighbor, taking hw_addr. Destinations share the
+// hw_addr of a neighbor, so a stale one is updated in place.
+static struct neighbor *mt_set_neighbor(struct mt *a, const struct addr *dst,
+                                        int if_index, struct addr *hw_addr) {
+    struct neighbor *n = mt_find_neighbor(a, dst);
+    if (n != NULL) {
+        memcpy(n->hw_addr->addr, hw_addr->addr, ADDR_ETH_SIZE);
+        addr_destroy(hw_addr);
+        n->if_index = if_index;
+        n->stale = 0;
+        return n;
+    }
+
+    n = malloc(sizeof(*n));
+    if (n == NULL) {
+        addr_destroy(hw_addr);
+        return NULL;
+    }
+    memset(n, 0, sizeof(*n));
+
+    n->ip_addr  = addr_copy(dst);
+    n->hw_addr  = hw_addr;
+    n->if_index = if_index;
+
+    int dst_size = (dst->type == ADDR_IPV4) ? ADDR_IPV4_SIZE : ADDR_IPV6_SIZE;
+    if (lru_put(a->neighbors, dst->addr, dst_size, n) == -1) {
+        neighbor_destroy(n);
+        return NULL;
+    }
+    return n;
+}
+
 struct neighbor *mt_get_neighbor(struct mt *a, const struct addr *dst,
                                    int if_index) {
+    struct neighbor *n = mt_find_neighbor(a, dst);
+    if (n != NULL && n->stale == 0) return n;
 
-    struct list_item *i = NULL;
-    for (i = a->neighbors->first; i != NULL; i = i->next) {
-        struct neighbor *n = (struct neighbor *)i->data;
-        int dst_size = (dst->type == ADDR_IPV4) ? ADDR_IPV4_SIZE : ADDR_IPV6_SIZE;
-        if (buff_cmp(dst->addr, n->ip_addr->addr, dst_size) == 0) return n;
-    }
+    struct addr *hw_addr = mt_nd(a, dst, if_index);
+    if (hw_addr == NULL) return NULL;
+    return mt_set_neighbor(a, dst, if_index, hw_addr);
+}
+
+struct mt_nd_pending {
+    struct addr *ip_addr;
+    int if_index;
+    struct probe *probe;
+};
 
-    struct addr *gw = mt_nd(a, dst, if_index);
-    if (gw != NULL) {
-        struct neighbor *n = malloc(sizeof(*n));
-        if (n == NULL) {
-            addr_destroy(gw);
-            return NULL;
+static int mt_nd_pending_cmp(const void *a, const void *b) {
+    const struct addr *ip_addr = (const struct addr *)a;
+    const struct mt_nd_pending *p = (const struct mt_nd_pending *)b;
+    int size = (ip_addr->type == ADDR_IPV4) ? ADDR_IPV4_SIZE : ADDR_IPV6_SIZE;
+    if (ip_addr->type != p->ip_addr->type) return 1;
+    return buff_cmp(ip_addr->addr, p->ip_addr->addr, size);
+}
+
+static int mt_nd_waiting(struct mt *a, struct list *pending) {
+    int count = 0;
+    struct list_item *it = NULL;
+    for (it = a->interfaces->first; it != NULL; it = it->next) {
+        struct interface *i = (struct interface *)it->data;
+        struct list_item *p = NULL;
+        for (p = pending->first; p != NULL; p = p->next) {
+            if (((struct mt_nd_pending *)p->data)->if_index == i->if_index) break;
         }
-        memset(n, 0, sizeof(*n));
+        if (p != NULL) mt_poll(a, i->if_index);
+    }
 
-        n->ip_addr  = addr_copy(dst);
-        n->hw_addr  = gw;
-        n->if_index = if_index;
+    struct list_item *p = NULL;
+    for (p = pending->first; p != NULL; p = p->next) {
+        const struct mt_nd_pending *nd = (const struct mt_nd_pending *)p->data;
+        struct interface *i = mt_get_interface(a, nd->if_index);
+        mt_lock(i, nd->probe);
+        if (mt_probe_pending(a, nd->probe)) count++;
+        mt_unlock(i, nd->probe);
+    }
+    return count;
+}
 
-        list_insert(a->neighbors, n);
-        return n;
+/* Resolves the next hops of many destinations together: the kernel table
+ * is dumped once and asked first, then every ARP request and neighbor
+ * solicitation still needed is sent before waiting for any reply, so
+ * resolving them takes a single timeout. The dst_create calls that follow
+ * find their neighbors cached.
+ */
+void mt_prefetch_neighbors(struct mt *a, const struct list *dsts) {
+    if (a->l3) return;
+
+    struct list *pending = list_create();
+    if (pending == NULL) return;
+
+    struct hash *tables[2] = { NULL, NULL };
+    struct list_item *it = NULL;
+    for (it = dsts->first; it != NULL; it = it->next) {
+        const struct addr *dst = (const struct addr *)it->data;
+        struct route *r = mt_get_route(a, dst);
+        if (r == NULL) continue;
+
+        const struct addr *next_hop = (r->gateway != NULL) ? r->gateway : dst;
+        struct neighbor *n = mt_find_neighbor(a, next_hop);
+        if (n != NULL && n->stale == 0) continue;
+        if (list_find(pending, next_hop, &mt_nd_pending_cmp) != NULL) continue;
+
+        // One dump of the kernel table per address type serves the batch
+        int v6 = (next_hop->type == ADDR_IPV6);
+        if (tables[v6] == NULL) tables[v6] = mt_nd_table_create(next_hop->type);
+        struct addr *hw_addr = (tables[v6] != NULL)
+            ? mt_nd_table_lookup(tables[v6], next_hop, r->if_index) : NULL;
+        if (hw_addr != NULL) {
+            mt_set_neighbor(a, next_hop, r->if_index, hw_addr);
+            continue;
+        }
+
+        struct mt_nd_pending *nd = malloc(sizeof(*nd));
+        if (nd == NULL) continue;
+        nd->probe = mt_nd_send(a, next_hop, r->if_index);
+        if (nd->probe == NULL) {
+            free(nd);
+            continue;
+        }
+        nd->ip_addr = addr_copy(next_hop);
+        nd->if_index = r->if_index;
+        list_insert(pending, nd);
     }
+    if (tables[0] != NULL) mt_nd_table_destroy(tables[0]);
+    if (tables[1] != NULL) mt_nd_table_destroy(tables[1]);
+
+    while (mt_nd_waiting(a, pending) > 0) usleep(MT_ND_IDLE_US);
+
+    while (pending->count > 0) {
+        struct mt_nd_pending *nd = (struct mt_nd_pending *)list_pop(pending);
+        mt_take_probe(a, nd->if_index, nd->probe);
 
-    return NULL;
+        struct addr *hw_addr = mt_nd_reply(nd->ip_addr, nd->probe);
+        if (hw_addr != NULL) {
+            mt_set_neighbor(a, nd->ip_addr, nd->if_index, hw_addr);
+        }
+        probe_destroy(nd->probe);
+        addr_destroy(nd->ip_addr);
+        free(nd);
+    }
+    list_destroy(pending);
 }
 
 void neighbor_destroy(struct neighbor *n) {
@@ -217,18 +720,49 @@ void neighbor_destroy(struct neighbor *n) {
     free(n);
 }
 
-static struct mt *mt_create(int wait, int send_wait, int retries) {
+static void mt_neighbor_free(void *data) {
+    neighbor_destroy((struct neighbor *)data);
+}
+
+// Destinations point at the hw_addr of their neighbor
+static int mt_neighbor_evictable(const void *data) {
+    return ((const struct neighbor *)data)->refs == 0;
+}
+
+static void mt_route_free(void *data) {
+    route_destroy((struct route *)data);
+}
+
+static struct mt *mt_create(int wait, int send_wait, int retries,
+                            int probe_budget, int l3, int raw_recv,
+                            int fanout) {
     struct mt *a = malloc(sizeof(*a));
     if (a == NULL) return NULL;
     memset(a, 0, sizeof(*a));
 
     a->interfaces = list_create();
-    a->neighbors = list_create();
-    a->routes = list_create();
+    a->interface_index = hash_create(0);
+    a->neighbors = lru_create(MT_NEIGHBORS_MAX, &mt_neighbor_free,
+                              &mt_neighbor_evictable);
+    a->routes = lru_create(MT_ROUTES_MAX, &mt_route_free, NULL);
+    a->route_table = route_table_create();
+    a->monitor = monitor_create();
+    a->ifaces = iface_table_create();
     a->retries = retries;
     a->probe_timeout = wait;
+    a->rto = rto_table_create(RTO_MIN_MS, wait * 1000);
+    a->probe_budget = probe_budget;
     a->send_wait = timespec_from_ms(send_wait);
     a->probes_count = 0;
+    a->l3 = l3;
+    a->raw_recv = raw_recv;
+    a->fanout = fanout;
+    pthread_mutex_init(&a->rto_lock, NULL);
+    if (l3) {
+        uint8_t zero[ADDR_ETH_SIZE];
+        memset(zero, 0, sizeof(zero));
+        a->l3_hw_addr = addr_create(ADDR_ETHERNET, zero);
+    }
 
     clock_gettime(CLOCK_REALTIME, &a->init_time);
     memset(&a->first_probe_time, 0, sizeof(a->first_probe_time));
@@ -243,19 +777,16 @@ static void mt_destroy(struct mt *a) {
         mt_interface_destroy(i);
     }
 
-    while (a->routes->count > 0) {
-        struct route *r = (struct route *)list_pop(a->routes);
-        route_destroy(r);
-    }
-
-    while (a->neighbors->count > 0) {
-        struct neighbor *n = (struct neighbor *)list_pop(a->neighbors);
-        neighbor_destroy(n);
-    }
-
-    list_destroy(a->routes);
-    list_destroy(a->neighbors);
+    lru_destroy(a->routes);
+    if (a->route_table != NULL) route_table_destroy(a->route_table);
+    if (a->monitor != NULL) monitor_destroy(a->monitor);
+    if (a->ifaces != NULL) iface_table_destroy(a->ifaces);
+    lru_destroy(a->neighbors);
+    hash_destroy(a->interface_index);
     list_destroy(a->interfaces);
+    rto_table_destroy(a->rto);
+    pthread_mutex_destroy(&a->rto_lock);
+    if (a->l3_hw_addr != NULL) addr_destroy(a->l3_hw_addr);
     free(a);
 }
 
@@ -267,13 +798,253 @@ int check_permissions(void) {
     return 1;
 }
 
+// Runs a command that measures a single destination
+static int mt_run(struct mt *a, const struct args *args, int cmd,
+                  struct dst *d) {
+    if (cmd == CMD_MDA) {
+        return mt_mda(a, d, args->a, args->f, args->t, args->g, args->b,
+                      (args->C[0] != 0) ? args->C : NULL,
+                      (args->o[0] != 0) ? args->o : NULL);
+    } else if (cmd == CMD_TRACEROUTE) {
+        return mt_traceroute(a, d, args->m, args->t, args->k, args->p, args->g,
+                             args->s, (args->S[0] != 0) ? args->S : NULL);
+    }
+    return -1;
+}
+
+/* Ping is paced by -I: without -z the send wait is half the interval over
+ * the addresses, so every echo goes out on time and a late one catches up.
+ * A -z too long for that is warned about, the echoes would fall behind.
+ */
+static void mt_ping_pace(struct mt *a, const struct args *args, int count) {
+    if (count == 0) return;
+    long gap_us = (long)args->I / count;
+    if (args->z < 0) {
+        a->send_wait.tv_sec = gap_us / 2 / 1000000;
+        a->send_wait.tv_nsec = (gap_us / 2 % 1000000) * 1000;
+    } else if ((long)args->z * 1000 > gap_us) {
+        printf("%d addresses every %d us need a send every %ld us, -z %d "
+               "allows one every %d ms\n", count, args->I, gap_us, args->z,
+               args->z);
+    }
+}
+
+static void mt_ping_dsts(struct mt *a, const struct args *args,
+                         struct list *dsts) {
+    if (dsts->count > 0) mt_ping(a, dsts, args->n, args->I, args->u);
+    while (dsts->count > 0) dst_destroy((struct dst *)list_pop(dsts));
+}
+
+// The stop sets of a batch are loaded once, for the source of its first
+// traceroute, and shared by all of them
+static struct stop_set *mt_batch_stop_set(const struct args *args,
+                                          const struct dst *d, char **src) {
+    struct stop_set *stop_set = stop_set_create();
+    if (stop_set == NULL) return NULL;
+    *src = addr_to_str(d->ip_src);
+    stop_set_load(stop_set, args->S, *src);
+    return stop_set;
+}
+
+struct mt_batch {
+    struct mt *a;
+    const struct args *args;
+    struct sched *s;
+    struct stop_set *stop_set;
+    char *src;
+};
+
+static void mt_batch_line(struct mt_batch *b, const char *line) {
+    struct mt *a = b->a;
+    const struct args *args = b->args;
+    char addr[128], cmd_str[32];
+    int n = sscanf(line, "%127s %31s", addr, cmd_str);
+    if (n < 1 || addr[0] == '#') return;
+
+    int cmd = args->c;
+    if (n == 2 && parse_cmd(cmd_str, &cmd) == -1) {
+        printf("unknown command %s for %s\n", cmd_str, addr);
+        return;
+    }
+
+    if (cmd == CMD_SWEEP) {
+        sched_run(b->s);
+        if (mt_sweep(a, addr, args->m, args->t, args->R) != 0) {
+            printf("check the destination prefix %s\n", addr);
+        }
+        return;
+    }
+
+    struct dst *d = dst_create_from_str(a, addr);
+    if (d == NULL) {
+        printf("check the destination address %s\n", addr);
+        return;
+    }
+
+    struct task *t = NULL;
+    if (cmd == CMD_PING) {
+        t = ping_task_create(d, 1, args->n, args->I, args->u);
+    } else if (cmd == CMD_TRACEROUTE) {
+        if (args->S[0] != 0 && b->stop_set == NULL) {
+            b->stop_set = mt_batch_stop_set(args, d, &b->src);
+        }
+        t = traceroute_task_create(d, 1, args->m, args->t, args->k, args->p,
+                                   args->g, args->s, b->stop_set);
+    } else {
+        sched_run(b->s);
+        mt_run(a, args, cmd, d);
+        fflush(stdout);
+    }
+
+    if (t != NULL) {
+        sched_add(b->s, t);
+    } else {
+        dst_destroy(d);
+    }
+}
+
+// Resolves the neighbors of the addresses in the lines read ahead
+static void mt_batch_prefetch(struct mt *a, char lines[][MT_BATCH_LINE],
+                              int count) {
+    struct list *addrs = list_create();
+    if (addrs == NULL) return;
+
+    int k = 0;
+    for (k = 0; k < count; k++) {
+        char str[128];
+        if (sscanf(lines[k], "%127s", str) != 1) continue;
+        int type = addr_guess_type(str);
+        if (type != ADDR_IPV4 && type != ADDR_IPV6) continue;
+        struct addr *addr = addr_create_from_str(type, str);
+        if (addr != NULL) list_insert(addrs, addr);
+    }
+
+    mt_prefetch_neighbors(a, addrs);
+    while (addrs->count > 0) addr_destroy((struct addr *)list_pop(addrs));
+    list_destroy(addrs);
+}
+
+/* Reads one target per line, "ADDRESS [command]", the command defaulting
+ * to -c. Lines are read MT_BATCH_AHEAD at a time and the neighbors of
+ * their addresses resolved together, then they are handled in order:
+ * traceroutes and pings are tasks of one scheduler that keeps up to -W of
+ * them running at once, MDA and sweeps wait for those to end and run on
+ * their own. Interfaces, routes and neighbors are shared by every target.
+ */
+static int mt_batch(struct mt *a, const struct args *args) {
+    FILE *in = stdin;
+    if (strcmp(args->i, "-") != 0) in = fopen(args->i, "r");
+    if (in == NULL) {
+        printf("could not open the input file %s\n", args->i);
+        return -1;
+    }
+
+    struct mt_batch b;
+    memset(&b, 0, sizeof(b));
+    b.a = a;
+    b.args = args;
+    b.s = sched_create(a, args->W);
+    char (*lines)[MT_BATCH_LINE] = malloc(MT_BATCH_AHEAD * sizeof(*lines));
+    if (b.s == NULL || lines == NULL) {
+        if (b.s != NULL) sched_destroy(b.s);
+        free(lines);
+        if (in != stdin) fclose(in);
+        return -1;
+    }
+
+    int count = 0;
+    do {
+        count = 0;
+        while (count < MT_BATCH_AHEAD &&
+               fgets(lines[count], MT_BATCH_LINE, in) != NULL) count++;
+
+        mt_refresh(a);
+        mt_batch_prefetch(a, lines, count);
+
+        int k = 0;
+        for (k = 0; k < count && !sched_interrupted(); k++) {
+            mt_batch_line(&b, lines[k]);
+        }
+    } while (count == MT_BATCH_AHEAD && !sched_interrupted());
+
+    sched_destroy(b.s);
+    if (b.stop_set != NULL) {
+        if (stop_set_save(b.stop_set, args->S, b.src) == -1) {
+            printf("could not write the stop set file %s\n", args->S);
+        }
+        stop_set_destroy(b.stop_set);
+        free(b.src);
+    }
+    free(lines);
+    if (in != stdin) fclose(in);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     if(!check_permissions()) return 1;
 
     struct args *args = get_args(argc, argv);
     if (args == NULL) return 1;
 
-    struct mt *a = mt_create(args->w, args->z, args->r);
+    int send_wait = (args->z >= 0) ? args->z : ARGS_SEND_WAIT;
+    struct mt *a = mt_create(args->w, send_wait, args->r, args->B,
+                             args->L, args->x == RECV_RAW, args->F);
+
+    if (args->i[0] != 0) {
+        int r = mt_batch(a, args);
+        mt_destroy(a);
+        free(args);
+        return (r != 0) ? 1 : 0;
+    }
+
+    // A sweep covers a whole prefix and has no single destination
+    if (args->c == CMD_SWEEP) {
+        int r = mt_sweep(a, args->dst, args->m, args->t, args->R);
+        if (r != 0) printf("check the destination prefix\n");
+        mt_destroy(a);
+        free(args);
+        return (r != 0) ? 1 : 0;
+    }
+
+    // Ping keeps echoes to all its destinations in flight together
+    if (args->c == CMD_PING) {
+        struct list *dsts = list_create();
+        struct list *addrs = list_create();
+        int k = 0;
+        for (k = 0; k < args->dst_count; k++) {
+            int type = addr_guess_type(args->dsts[k]);
+            if (type != ADDR_IPV4 && type != ADDR_IPV6) continue;
+            struct addr *addr = addr_create_from_str(type, args->dsts[k]);
+            if (addr != NULL) list_insert(addrs, addr);
+        }
+        mt_prefetch_neighbors(a, addrs);
+        while (addrs->count > 0) addr_destroy((struct addr *)list_pop(addrs));
+        list_destroy(addrs);
+
+        for (k = 0; k < args->dst_count; k++) {
+            struct dst *d = dst_create_from_str(a, args->dsts[k]);
+            if (d == NULL) {
+                printf("check the destination address %s\n", args->dsts[k]);
+                continue;
+            }
+            list_insert(dsts, d);
+        }
+
+        int r = (dsts->count > 0) ? 0 : -1;
+        mt_ping_pace(a, args, dsts->count);
+        mt_ping_dsts(a, args, dsts);
+        list_destroy(dsts);
+        mt_destroy(a);
+        free(args);
+        return (r != 0) ? 1 : 0;
+    }
+
+    if (args->dst_count > 1) {
+        printf("only ping takes several destinations\n");
+        mt_destroy(a);
+        free(args);
+        return 1;
+    }
 
     struct dst *d = dst_create_from_str(a, args->dst);
 
@@ -284,13 +1055,7 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    if (args->c == CMD_PING) {
-        mt_ping(a, d, args->n);
-    } else if (args->c == CMD_MDA) {
-        mt_mda(a, d, args->a, args->f, args->t);
-    } else if (args->c == CMD_TRACEROUTE) {
-        mt_traceroute(a, d, args->m, args->t, args->p);
-    }
+    mt_run(a, args, args->c, d);
 
     dst_destroy(d);
     mt_destroy(a);
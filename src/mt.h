@@ -30,12 +30,20 @@
 #define __MT_H__
 
 #include <time.h>
+#include <pthread.h>
 #include <net/if.h>
 #include <pcap.h>
 
 #include "list.h"
 #include "probe.h"
 #include "route.h"
+#include "rto.h"
+
+struct monitor;
+struct raw_recv;
+struct fanout;
+struct lru;
+struct hash;
 
 #define MT_PCAP_SNAPLEN 1518
 #define MT_PCAP_PROMISC 0
@@ -43,12 +51,28 @@
 
 struct mt {
     struct list *interfaces;
-    struct list *neighbors;
-    struct list *routes;
+    struct hash *interface_index; // if_index to interface
+    struct lru *neighbors; // by IP address
+    struct lru *routes; // single lookups, of destinations the table missed
+    struct route_table *route_table;
+    int route_table_stale; // dumped again on the next lookup
+    struct iface_table *ifaces;
+    int ifaces_stale;
+    struct monitor *monitor;
+
+    // Probes go out on raw IP sockets and the kernel resolves the next
+    // hop, frames carry l3_hw_addr in place of MAC addresses
+    int l3;
+    struct addr *l3_hw_addr;
+    int raw_recv; // replies are read from raw ICMP and TCP sockets
+    int fanout; // receive sockets and threads per interface, 0 for none
 
     int retries;
-    int probe_timeout;
+    int probe_timeout; // seconds, the most a probe is waited for
+    struct rto_table *rto;
+    int probe_budget;
     struct timespec send_wait;
+    pthread_mutex_t rto_lock; // fanout threads update RTOs on replies
 
     // Statistics
     int probes_count;
@@ -64,18 +88,52 @@ struct interface {
     struct link *link;
     struct list *probes;
     pcap_t *pcap_handle;
+    struct raw_recv *raw_recv; // NULL when replies come through pcap
+    struct fanout *fanout; // NULL when replies are matched in this thread
+    int datalink;
+    uint8_t *frame; // captures of non-Ethernet links, framed again
+
+    // The send wait applies to each interface on its own, so probes
+    // leaving through different interfaces do not hold each other back
+    int probes_count;
+    struct timespec last_probe_time;
 };
 
 struct neighbor {
     int if_index;
     struct addr *ip_addr;
     struct addr *hw_addr;
+    int stale; // resolved again before it is handed out
+    int refs; // destinations using hw_addr, not evicted while any
 };
 
+// Lets a caller stop waiting before every probe is answered or timed out,
+// called with no shard locked
+typedef int (*mt_done_fn)(struct mt *a, struct interface *i, void *ctx);
+
+// Receives frames that are not matched against sent probes
+typedef void (*mt_receive_fn)(const uint8_t *buf, uint32_t len,
+                              const struct timespec *ts, void *ctx);
+
 struct probe *mt_send(struct mt *a, int if_index, const uint8_t *buf, uint32_t len, match_fn fn);
+void mt_send_once(struct mt *a, struct probe *p);
+int mt_send_raw(struct mt *a, int if_index, const uint8_t *buf, uint32_t len);
 void mt_wait(struct mt *a, int if_index);
+void mt_wait_fn(struct mt *a, int if_index, mt_done_fn done, void *ctx);
+int mt_dispatch(struct mt *a, int if_index, mt_receive_fn fn, void *ctx);
+int mt_poll(struct mt *a, int if_index);
+struct probe *mt_pop_probe(struct mt *a, int if_index);
+int mt_pop_probes(struct mt *a, int if_index, struct list *done);
+void mt_wait_probe(struct mt *a, int if_index, struct probe *p);
+int mt_send_ready(struct mt *a, int if_index);
+void mt_refresh(struct mt *a);
+struct addr *mt_iface_hw_addr(struct mt *a, int if_index);
+struct addr *mt_iface_ip_addr(struct mt *a, int if_index, int type);
+struct addr *mt_iface_src_addr(struct mt *a, const struct route *r, int type);
 struct route *mt_get_route(struct mt *a, const struct addr *dst);
 struct interface *mt_get_interface(struct mt *a, int if_index);
 struct neighbor *mt_get_neighbor(struct mt *a, const struct addr *dst, int if_index);
+void mt_prefetch_neighbors(struct mt *a, const struct list *dsts);
+void neighbor_destroy(struct neighbor *n);
 
 #endif // __MT_H__
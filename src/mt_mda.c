@@ -48,6 +48,9 @@
 #include "util.h"
 #include "match.h"
 #include "buffer.h"
+#include "mda_cache.h"
+#include "mda_graph.h"
+#include "hash.h"
 #include "mt_mda.h"
 
 #define MDA_ICMP_ID       0xffff
@@ -59,11 +62,17 @@
 #define MDA_MAX_FLOW_ID   255
 #define MDA_FLOWS_AT_ONCE 16
 
+// Exploration levels, lowered as the probe budgets run out
+#define MDA_LEVEL_FULL    0 // the requested confidence
+#define MDA_LEVEL_REDUCED 1 // the lowest confidence (90%)
+#define MDA_LEVEL_SINGLE  2 // a single flow per vertex
+
 struct flow_ttl {
     uint8_t ttl;
     uint16_t flow_id;
     char *response;
     int response_type;
+    struct timespec rtt;
 };
 
 struct next_hop {
@@ -89,18 +98,33 @@ static void next_hop_destroy(struct next_hop *nh) {
     free(nh);
 }
 
+// Responses observed for one flow id, indexed by ttl
+struct flow_path {
+    uint16_t flow_id;
+    struct flow_ttl **hops;
+};
+
 struct mda {
     char *root;
     int max_ttl;
     int confidence;
     int flow_type;
     struct list *flow_list;
+    struct list *paths;       // flow_path, in the order flows were seen
+    struct hash *paths_index; // flow id -> flow_path
+    int path_len;
     struct mt *mt;
     struct dst *dst;
+    const char *cache_path;
+    struct mda_graph *graph;
+    int gap_limit;
+    int probe_budget;
+    int probes_start;
 };
 
 static struct mda *mda_create(struct mt *a, struct dst *d, int flow_type,
-                              int confidence, int max_ttl) {
+                              int confidence, int max_ttl,
+                              const char *cache_path) {
     struct mda *mda = malloc(sizeof(*mda));
     if (mda == NULL) return NULL;
     memset(mda, 0, sizeof(*mda));
@@ -109,8 +133,12 @@ static struct mda *mda_create(struct mt *a, struct dst *d, int flow_type,
     mda->max_ttl    = max_ttl;
     mda->flow_type  = flow_type;
     mda->flow_list  = list_create();
+    mda->paths      = list_create();
+    mda->paths_index = hash_create(0);
+    mda->path_len   = max_ttl + 2;
     mda->mt         = a;
     mda->dst        = d;
+    mda->cache_path = cache_path;
     return mda;
 }
 
@@ -121,6 +149,13 @@ static void mda_destroy(struct mda *mda) {
         free(f);
     }
     list_destroy(mda->flow_list);
+    while (mda->paths->count > 0) {
+        struct flow_path *fp = (struct flow_path *)list_pop(mda->paths);
+        free(fp->hops);
+        free(fp);
+    }
+    list_destroy(mda->paths);
+    hash_destroy(mda->paths_index);
     free(mda->root);
     free(mda);
 }
@@ -306,6 +341,7 @@ static struct flow_ttl *flow_ttl_create(int ttl, uint16_t flow_id,
                                         char *resp, int type) {
     struct flow_ttl *ft = malloc(sizeof(*ft));
     if (ft == NULL) return NULL;
+    memset(ft, 0, sizeof(*ft));
     ft->ttl           = ttl;
     ft->flow_id       = flow_id;
     ft->response      = strdup(resp);
@@ -313,19 +349,53 @@ static struct flow_ttl *flow_ttl_create(int ttl, uint16_t flow_id,
     return ft;
 }
 
-static void add_flow(struct mda *mda, int ttl, uint16_t flow_id,
-                     char *resp, int type) {
+static struct flow_path *get_flow_path(struct mda *mda, uint16_t flow_id,
+                                       int create) {
+    struct flow_path *fp = hash_get(mda->paths_index, &flow_id,
+                                    sizeof(flow_id));
+    if (fp != NULL || create == 0) return fp;
+
+    fp = malloc(sizeof(*fp));
+    if (fp == NULL) return NULL;
+    fp->flow_id = flow_id;
+    fp->hops = calloc(mda->path_len, sizeof(*fp->hops));
+    if (fp->hops == NULL) {
+        free(fp);
+        return NULL;
+    }
+    if (hash_put(mda->paths_index, &fp->flow_id, sizeof(fp->flow_id), fp) < 0) {
+        free(fp->hops);
+        free(fp);
+        return NULL;
+    }
+    list_insert(mda->paths, fp);
+    return fp;
+}
+
+static struct flow_ttl *add_flow(struct mda *mda, int ttl, uint16_t flow_id,
+                                 char *resp, int type) {
     struct flow_ttl *ft = flow_ttl_create(ttl, flow_id, resp, type);
+    if (ft == NULL) return NULL;
     list_insert(mda->flow_list, ft);
+
+    // The first response of a flow at a ttl is the one get_flow returns,
+    // later ones only matter to the per-packet test
+    struct flow_path *fp = get_flow_path(mda, flow_id, 1);
+    if (fp != NULL && ttl < mda->path_len && fp->hops[ttl] == NULL) {
+        fp->hops[ttl] = ft;
+    }
+    return ft;
+}
+
+static struct flow_ttl *get_flow(struct mda *mda, int ttl, uint16_t flow_id) {
+    if (ttl < 0 || ttl >= mda->path_len) return NULL;
+    struct flow_path *fp = get_flow_path(mda, flow_id, 0);
+    if (fp == NULL) return NULL;
+    return fp->hops[ttl];
 }
 
 static int has_flow_id(struct mda *mda, int ttl, uint16_t flow_id) {
-    struct list_item *it = NULL;
-    for (it = mda->flow_list->first; it != NULL; it = it->next) {
-        struct flow_ttl *f = (struct flow_ttl *)it->data;
-        if (f->ttl == ttl && f->flow_id == flow_id) return 1;
-    }
-    return 0;
+    return get_flow(mda, ttl, flow_id) != NULL;
 }
 
 static int get_nth_flow_id_available(struct mda *mda, int n, int ttl) {
@@ -422,7 +492,10 @@ static void mda_read_response(struct mda *m, struct probe *p, char **src_addr,
             if (rip->protocol == PROTO_ICMPV4) {
                 type = get_icmp4_type(p->response);
             }
-            add_flow(m, ttl, flow_id, *src_addr, type);
+            struct flow_ttl *f = add_flow(m, ttl, flow_id, *src_addr, type);
+            if (f != NULL) {
+                f->rtt = timespec_diff(&p->response_time, &p->sent_time);
+            }
 
             if (rtt != NULL) {
                 *rtt = timespec_diff(&p->response_time, &p->sent_time);
@@ -480,7 +553,10 @@ static void mda_read_response(struct mda *m, struct probe *p, char **src_addr,
             if (rip->next_header == PROTO_ICMPV6) {
                 type = get_icmp6_type(p->response);
             }
-            add_flow(m, ttl, flow_id, *src_addr, type);
+            struct flow_ttl *f = add_flow(m, ttl, flow_id, *src_addr, type);
+            if (f != NULL) {
+                f->rtt = timespec_diff(&p->response_time, &p->sent_time);
+            }
 
             if (rtt != NULL) {
                 *rtt = timespec_diff(&p->response_time, &p->sent_time);
@@ -505,10 +581,9 @@ static int is_per_packet(struct mda *mda, int flow_id, int ttl, int n) {
 
     struct list *nh = list_create();
 
-    struct interface *inter = mt_get_interface(mda->mt, mda->dst->if_index);
     int found = 0;
-    while (inter->probes->count > 0) {
-        struct probe *probe = (struct probe *)list_pop(inter->probes);
+    struct probe *probe = NULL;
+    while ((probe = mt_pop_probe(mda->mt, mda->dst->if_index)) != NULL) {
         char *addr = NULL;
         mda_read_response(mda, probe, &addr, NULL);
         if (strcmp(addr, "*") != 0 && list_find(nh, addr, &strcmp_void) == NULL) {
@@ -535,10 +610,23 @@ static int next_hops(struct mda *mda, char *addr, int ttl, struct list *flows,
 
     int sent = 0;
     int sent_new = 0;
+    int found = 0;
     while (flows->count > 0) {
         struct flow_ttl *f = (struct flow_ttl *)list_pop(flows);
-
-        if (has_flow_id(mda, ttl + 1, f->flow_id) == 1) {
+        struct flow_ttl *next = get_flow(mda, ttl + 1, f->flow_id);
+
+        if (next != NULL) {
+            // The flow was already probed, e.g., when verifying a cached
+            // flow, make sure its interface is listed as a next hop
+            struct next_hop *nh = next_hop_create(strdup(next->response),
+                                                  next->rtt);
+            if (list_find(nh_list, nh, &next_hop_cmp) == NULL) {
+                list_insert(nh_list, nh);
+                found++;
+            } else {
+                free(nh->addr);
+                next_hop_destroy(nh);
+            }
             sent++;
         } else if (sent < n) {
             mda_send(mda, f->flow_id, f->flow_id, ttl + 1);
@@ -551,11 +639,8 @@ static int next_hops(struct mda *mda, char *addr, int ttl, struct list *flows,
 
     mt_wait(mda->mt, mda->dst->if_index);
 
-    struct interface *inter = mt_get_interface(mda->mt, mda->dst->if_index);
-
-    int found = 0;
-    while (inter->probes->count > 0) {
-        struct probe *probe = (struct probe *)list_pop(inter->probes);
+    struct probe *probe = NULL;
+    while ((probe = mt_pop_probe(mda->mt, mda->dst->if_index)) != NULL) {
         char *addr = NULL;
         struct timespec rtt;
         mda_read_response(mda, probe, &addr, &rtt);
@@ -574,6 +659,75 @@ static int next_hops(struct mda *mda, char *addr, int ttl, struct list *flows,
     return found;
 }
 
+static int ptr_cmp(const void *a, const void *b) {
+    return a != b;
+}
+
+static void ttl_addr_key(char *key, size_t len, int ttl, const char *addr) {
+    snprintf(key, len, "%d %s", ttl, addr);
+}
+
+// Node control: flows not yet probed at ttl that are likely to reach addr
+// there. Flows seen deeper on a vertex downstream of addr come first, as
+// they most likely crossed it; then flows that reached one of its
+// predecessors at ttl - 1. Both avoid spending fresh ids on other branches.
+static struct list *predict_flows(struct mda *mda, char *addr, int ttl) {
+    struct hash *pred = hash_create(0);
+    struct hash *down = hash_create(0);
+    char key[128];
+    struct list_item *it = NULL;
+    int t = 0;
+
+    for (it = mda->paths->first; it != NULL; it = it->next) {
+        struct flow_path *fp = (struct flow_path *)it->data;
+        if (fp->hops[ttl] == NULL) continue;
+        if (strcmp(fp->hops[ttl]->response, addr) != 0) continue;
+
+        struct flow_ttl *prev = fp->hops[ttl - 1];
+        if (prev != NULL && strcmp(prev->response, "*") != 0) {
+            hash_put(pred, prev->response, strlen(prev->response), fp);
+        }
+        for (t = ttl + 1; t < mda->path_len; t++) {
+            struct flow_ttl *f = fp->hops[t];
+            if (f == NULL || strcmp(f->response, "*") == 0) continue;
+            ttl_addr_key(key, sizeof(key), t, f->response);
+            hash_put(down, key, strlen(key), fp);
+        }
+    }
+
+    struct list *likely = list_create();
+    struct list *maybe = list_create();
+    for (it = mda->paths->first; it != NULL; it = it->next) {
+        struct flow_path *fp = (struct flow_path *)it->data;
+        if (fp->hops[ttl] != NULL) continue;
+        if (fp->flow_id < MDA_MIN_FLOW_ID || fp->flow_id > MDA_MAX_FLOW_ID) {
+            continue;
+        }
+
+        int downstream = 0;
+        for (t = ttl + 1; t < mda->path_len && downstream == 0; t++) {
+            struct flow_ttl *f = fp->hops[t];
+            if (f == NULL) continue;
+            ttl_addr_key(key, sizeof(key), t, f->response);
+            if (hash_get(down, key, strlen(key)) != NULL) downstream = 1;
+        }
+
+        struct flow_ttl *prev = fp->hops[ttl - 1];
+        if (downstream == 1) {
+            list_insert(likely, fp);
+        } else if (prev != NULL &&
+                   hash_get(pred, prev->response, strlen(prev->response)) != NULL) {
+            list_insert(maybe, fp);
+        }
+    }
+
+    while (maybe->count > 0) list_insert(likely, list_pop(maybe));
+    list_destroy(maybe);
+    hash_destroy(pred);
+    hash_destroy(down);
+    return likely;
+}
+
 static void more_flows(struct mda *mda, char *addr, int ttl, int n) {
     if (ttl == 0) {
         int found = 0;
@@ -597,21 +751,36 @@ static void more_flows(struct mda *mda, char *addr, int ttl, int n) {
     while (found < n && stop == 0) {
         int missing = n - found;
         int send = missing > MDA_FLOWS_AT_ONCE ? missing : MDA_FLOWS_AT_ONCE;
+        struct list *predicted = predict_flows(mda, addr, ttl);
+        struct list *sent = list_create();
+        int nth = 1;
         int i = 0;
-        for (i = 1; i <= send; i++) {
-            int flow_id = get_nth_flow_id_available(mda, i, ttl);
-            if (flow_id == -1) {
-                stop = 1;
-                break;
+        for (i = 0; i < send; i++) {
+            int flow_id = -1;
+            if (predicted->count > 0) {
+                struct flow_path *fp = (struct flow_path *)list_pop(predicted);
+                flow_id = fp->flow_id;
+                list_insert(sent, fp);
+            } else {
+                // Fresh ids must not repeat a predicted one sent above
+                do {
+                    flow_id = get_nth_flow_id_available(mda, nth++, ttl);
+                } while (flow_id != -1 && list_find(sent,
+                         get_flow_path(mda, flow_id, 0), &ptr_cmp) != NULL);
+                if (flow_id == -1) {
+                    stop = 1;
+                    break;
+                }
             }
             mda_send(mda, flow_id, flow_id, ttl);
         }
+        list_destroy(predicted);
+        list_destroy(sent);
 
         mt_wait(mda->mt, mda->dst->if_index);
 
-        struct interface *inter = mt_get_interface(mda->mt, mda->dst->if_index);
-        while (inter->probes->count > 0) {
-            struct probe *probe = (struct probe *)list_pop(inter->probes);
+        struct probe *probe = NULL;
+        while ((probe = mt_pop_probe(mda->mt, mda->dst->if_index)) != NULL) {
             char *resp = NULL;
             mda_read_response(mda, probe, &resp, NULL);
             if (strcmp(resp, addr) == 0) found++;
@@ -621,12 +790,125 @@ static void more_flows(struct mda *mda, char *addr, int ttl, int n) {
     }
 }
 
-static void mda_print(int ttl, char *addr, struct list *nh, int per_packet) {
-    if (per_packet == 1) {
-        printf("%2d  %s (P): ", ttl, addr);
-    } else {
-        printf("%2d  %s: ", ttl, addr);
+// Send one probe for each flow id of a previous run, so the exploration
+// below only needs to probe where the topology has changed
+static void mda_cache_verify(struct mda *mda) {
+    char *src = addr_to_str(mda->dst->ip_src);
+    char *dst = addr_to_str(mda->dst->ip_dst);
+    struct list *cached = mda_cache_load(mda->cache_path, src, dst,
+                                         mda->flow_type);
+    free(src);
+    free(dst);
+    if (cached == NULL) return;
+
+    struct list_item *it = NULL;
+    for (it = cached->first; it != NULL; it = it->next) {
+        struct mda_cache_entry *e = (struct mda_cache_entry *)it->data;
+        if (e->ttl > mda->max_ttl) continue;
+        if (has_flow_id(mda, 0, e->flow_id) == 0) {
+            add_flow(mda, 0, e->flow_id, mda->root, -1);
+        }
+        if (has_flow_id(mda, e->ttl, e->flow_id) == 1) continue;
+        mda_send(mda, e->flow_id, e->flow_id, e->ttl);
+    }
+
+    mda_cache_destroy(cached);
+
+    mt_wait(mda->mt, mda->dst->if_index);
+
+    struct probe *probe = NULL;
+    while ((probe = mt_pop_probe(mda->mt, mda->dst->if_index)) != NULL) {
+        char *resp = NULL;
+        mda_read_response(mda, probe, &resp, NULL);
+        free(resp);
+        probe_destroy(probe);
+    }
+}
+
+static void mda_cache_store(struct mda *mda) {
+    struct list *entries = list_create();
+    if (entries == NULL) return;
+
+    struct list_item *it = NULL;
+    for (it = mda->flow_list->first; it != NULL; it = it->next) {
+        struct flow_ttl *f = (struct flow_ttl *)it->data;
+        if (f->ttl == 0 || strcmp(f->response, "*") == 0) continue;
+        struct mda_cache_entry *e = mda_cache_entry_create(f->ttl, f->flow_id,
+                                                           f->response,
+                                                           f->response_type);
+        if (e != NULL) list_insert(entries, e);
+    }
+
+    char *src = addr_to_str(mda->dst->ip_src);
+    char *dst = addr_to_str(mda->dst->ip_dst);
+    if (mda_cache_save(mda->cache_path, src, dst, mda->flow_type, entries) == -1) {
+        printf("could not write the cache file %s\n", mda->cache_path);
+    }
+    free(src);
+    free(dst);
+    mda_cache_destroy(entries);
+}
+
+// Returns 1 if every flow probed at ttl timed out
+static int is_gap(struct mda *mda, int ttl) {
+    struct list *addrs = get_interfaces_ttl(mda, ttl);
+    int gap = 1;
+    struct list_item *it = NULL;
+    for (it = addrs->first; it != NULL; it = it->next) {
+        if (strcmp((char *)it->data, "*") != 0) gap = 0;
+    }
+    if (addrs->count == 0) gap = 0;
+    list_destroy(addrs);
+    return gap;
+}
+
+static void mda_print_summary(struct mda *mda, const char *stop, int hops,
+                              int probes) {
+    char *addr_dst = addr_to_str(mda->dst->ip_dst);
+    printf("# %s stop=%s hops=%d probes=%d\n", addr_dst, stop, hops, probes);
+    free(addr_dst);
+}
+
+// Add the edges from addr at ttl, i.e., every flow through addr that was
+// probed at ttl + 1, and stream them out
+static void mda_graph_update(struct mda *mda, int ttl, char *addr,
+                             int per_packet) {
+    struct list *flows = get_flows(mda, ttl, addr);
+    struct list_item *it = NULL;
+    for (it = flows->first; it != NULL; it = it->next) {
+        struct flow_ttl *f = (struct flow_ttl *)it->data;
+        struct flow_ttl *next = get_flow(mda, ttl + 1, f->flow_id);
+        if (next == NULL) continue;
+        mda_graph_edge(mda->graph, ttl, addr, next->response, f->flow_id,
+                       next->rtt);
     }
+    list_destroy(flows);
+    mda_graph_flush(mda->graph, per_packet);
+}
+
+static int budget_level(int used, int budget) {
+    if (budget <= 0) return MDA_LEVEL_FULL;
+    if (used >= budget) return MDA_LEVEL_SINGLE;
+    if (used * 4 >= budget * 3) return MDA_LEVEL_REDUCED;
+    return MDA_LEVEL_FULL;
+}
+
+// Lower the confidence once 3/4 of the trace or of the run budget is used,
+// and probe a single flow per vertex once any of them is exhausted
+static int mda_level(struct mda *mda) {
+    int used  = mda->mt->probes_count - mda->probes_start;
+    int trace = budget_level(used, mda->probe_budget);
+    int run   = budget_level(mda->mt->probes_count, mda->mt->probe_budget);
+    return (trace > run) ? trace : run;
+}
+
+static void mda_print(int ttl, char *addr, struct list *nh, int per_packet,
+                      int level) {
+    printf("%2d  %s", ttl, addr);
+    if (per_packet == 1) printf(" (P)");
+    if (level == MDA_LEVEL_REDUCED) printf(" (L)");
+    if (level == MDA_LEVEL_SINGLE) printf(" (S)");
+    printf(": ");
     struct list_item *i = NULL;
     for (i = nh->first; i != NULL; i = i->next) {
         struct next_hop *nh = (struct next_hop *)i->data;
@@ -688,16 +970,35 @@ static int mda(struct mda *mda) {
         { 890,  980, 1185}, { 898,  989, 1195}, { 906,  998, 1206},
     };
 
+    // Probes re-verifying the cache count against the budget as well
+    mda->probes_start = mda->mt->probes_count;
+    if (mda->cache_path != NULL) mda_cache_verify(mda);
+
     // Initialize the first flows for root
     int n = k[2][mda->confidence];
     int i = 0;
     for (i = 0; i < n; i++) {
+        if (has_flow_id(mda, 0, MDA_MIN_FLOW_ID + i) == 1) continue;
         add_flow(mda, 0, MDA_MIN_FLOW_ID + i, mda->root, -1);
     }
 
+    const char *stop = "max-ttl";
+    int hops = 0;
+    int gap = 0;
+
     int ttl = 0;
     for (ttl = 0; ttl <= mda->max_ttl; ttl++) {
+        // Stop after gap_limit consecutive TTLs with no answer at all
+        if (ttl > 0 && mda->gap_limit > 0) {
+            gap = is_gap(mda, ttl) ? gap + 1 : 0;
+            if (gap >= mda->gap_limit) {
+                stop = "gap-limit";
+                break;
+            }
+        }
+
         struct list *addrs_ttl = get_flows_ttl(mda, ttl);
+        if (addrs_ttl->count > 0) hops = ttl;
 
         while (addrs_ttl->count > 0) {
             struct flow_ttl *fttl = (struct flow_ttl *)list_pop(addrs_ttl);
@@ -706,22 +1007,26 @@ static int mda(struct mda *mda) {
             char *addr_dst = addr_to_str(mda->dst->ip_dst);
             if (strcmp(addr, addr_dst) == 0) {
                 free(addr_dst);
+                stop = "completed";
                 continue;
             }
             free(addr_dst);
 
             if (mda->dst->ip_dst->type == ADDR_IPV4 &&
                 fttl->response_type == ICMPV4_TYPE_UNREACH) {
+                if (strcmp(stop, "completed") != 0) stop = "unreachable";
                 continue;
             }
             else if (mda->dst->ip_dst->type == ADDR_IPV6 &&
                 fttl->response_type == ICMPV6_TYPE_UNREACH) {
+                if (strcmp(stop, "completed") != 0) stop = "unreachable";
                 continue;
             }            
             
             struct list *nh_list = list_create();
             int flows_sent = 0;
             int new_next_hop = 1;
+            int level = MDA_LEVEL_FULL;
             while (new_next_hop) {
 
                 struct list *flows = get_flows(mda, ttl, addr);
@@ -729,7 +1034,16 @@ static int mda(struct mda *mda) {
                 int total_next_hops = nh_list->count;
                 if (nh_list->count == 0) total_next_hops = 1;
 
-                n = k[total_next_hops+1][mda->confidence];
+                int current = mda_level(mda);
+                if (current > level) level = current;
+
+                if (level == MDA_LEVEL_SINGLE) {
+                    n = 1;
+                } else if (level == MDA_LEVEL_REDUCED) {
+                    n = k[total_next_hops+1][0];
+                } else {
+                    n = k[total_next_hops+1][mda->confidence];
+                }
                 
                 if (flows->count < n) {
                     more_flows(mda, addr, ttl, n - flows->count);
@@ -743,7 +1057,7 @@ static int mda(struct mda *mda) {
             }
 
             int per_packet = 0;
-            if (nh_list->count > 1) {
+            if (nh_list->count > 1 && level != MDA_LEVEL_SINGLE) {
                 struct list *flows = get_flows(mda, ttl, addr);
                 struct flow_ttl *f = (struct flow_ttl *)list_pop(flows);
                 n = k[2][mda->confidence];
@@ -752,7 +1066,11 @@ static int mda(struct mda *mda) {
                 list_destroy(flows);
             }
 
-            mda_print(ttl, addr, nh_list, per_packet);
+            if (mda->graph != NULL) {
+                mda_graph_update(mda, ttl, addr, per_packet);
+            }
+
+            mda_print(ttl, addr, nh_list, per_packet, level);
 
             while (nh_list->count > 0) {
                 struct next_hop *nh = (struct next_hop *)list_pop(nh_list);
@@ -765,19 +1083,61 @@ static int mda(struct mda *mda) {
         list_destroy(addrs_ttl);
     }
 
+    // Everything sent to the destination, cache verification included
+    mda_print_summary(mda, stop, hops,
+                      mda->mt->probes_count - mda->probes_start);
+
+    if (mda->cache_path != NULL) mda_cache_store(mda);
+
     return 0;
 }
 
+static struct mda_graph *mda_graph_open(struct mda *m, const char *path) {
+    FILE *out = stdout;
+    if (strcmp(path, "-") != 0) out = fopen(path, "w");
+    if (out == NULL) return NULL;
+
+    char *src = addr_to_str(m->dst->ip_src);
+    char *dst = addr_to_str(m->dst->ip_dst);
+    struct mda_graph *g = mda_graph_create(out, src, dst, m->flow_type);
+    free(src);
+    free(dst);
+
+    if (g == NULL && out != stdout) fclose(out);
+    return g;
+}
+
+static void mda_graph_close(struct mda_graph *g) {
+    FILE *out = g->out;
+    mda_graph_destroy(g);
+    if (out != stdout) fclose(out);
+}
+
 int mt_mda(struct mt *a, struct dst *dst, int confidence,
-           int flow_type, int max_ttl) {
+           int flow_type, int max_ttl, int gap_limit, int probe_budget,
+           const char *cache_path, const char *graph_path) {
 
     if (confidence == 90)      confidence = 0;
     else if (confidence == 95) confidence = 1;
     else if (confidence == 99) confidence = 2;
 
     if (dst->ip_dst->type == ADDR_IPV4 || dst->ip_dst->type == ADDR_IPV6) {
-        struct mda *m = mda_create(a, dst, flow_type, confidence, max_ttl);
+        struct mda *m = mda_create(a, dst, flow_type, confidence, max_ttl,
+                                   cache_path);
+        m->gap_limit    = gap_limit;
+        m->probe_budget = probe_budget;
+        if (graph_path != NULL) {
+            m->graph = mda_graph_open(m, graph_path);
+            if (m->graph == NULL) {
+                printf("could not open the graph output %s\n", graph_path);
+                mda_destroy(m);
+                return -1;
+            }
+        }
+
         int result = mda(m);
+
+        if (m->graph != NULL) mda_graph_close(m->graph);
         mda_destroy(m);
         return result;
     }
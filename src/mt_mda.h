@@ -33,6 +33,7 @@
 #include "dst.h"
 
 int mt_mda(struct mt *a, struct dst *dst, int confidence,
-           int flow_type, int max_ttl);
+           int flow_type, int max_ttl, int gap_limit, int probe_budget,
+           const char *cache_path, const char *graph_path);
 
 #endif // __MT_MDA_H__
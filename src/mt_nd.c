@@ -29,6 +29,11 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
 
 #include "packet.h"
 #include "pdu_eth.h"
@@ -43,6 +48,9 @@
 
 #include <stdio.h>
 
+// Receive buffer of the neighbor table dump
+#define NEIGH_DUMPBUF 32768
+
 static struct packet *neighbor6_packet(const uint8_t *mac_src,
                                        const uint8_t *src_addr,
                                        const uint8_t *dst_addr) {
@@ -89,13 +97,13 @@ static int neighbor4_match(const uint8_t *probe, uint32_t probe_len,
     return 0;
 }
 
-static struct addr *neighbor4(struct mt *a, const struct addr *addr,
-                              int if_index) {
+static struct probe *neighbor4_send(struct mt *a, const struct addr *addr,
+                                    int if_index) {
 
-    struct addr *if_hw = iface_hw_addr(if_index);
+    struct addr *if_hw = mt_iface_hw_addr(a, if_index);
     if (if_hw == NULL) return NULL;
 
-    struct addr *if_ip = iface_ip_addr(if_index, addr->type);
+    struct addr *if_ip = mt_iface_ip_addr(a, if_index, addr->type);
     if (if_ip == NULL) {
         addr_destroy(if_hw);
         return NULL;
@@ -106,26 +114,20 @@ static struct addr *neighbor4(struct mt *a, const struct addr *addr,
     pdu_eth_arp(p, if_hw->addr);
     pdu_arp_request(p, if_hw->addr, if_ip->addr, addr->addr);
 
-    mt_send(a, if_index, p->buf, p->length, &neighbor4_match);
-    mt_wait(a, if_index);
-
-    struct addr *resp = NULL;
-
-    struct interface *i = mt_get_interface(a, if_index);
-    while (i->probes->count > 0) {
-        struct probe *probe = (struct probe *)list_pop(i->probes);
-        if (probe->response_len > 0) {
-            struct arp_hdr *r_arp = (struct arp_hdr *)(probe->response + ETH_H_SIZE);
-            resp = addr_create(ADDR_ETHERNET, r_arp->sender_hw);
-        }
-        probe_destroy(probe);
-    }
+    struct probe *probe = mt_send(a, if_index, p->buf, p->length,
+                                  &neighbor4_match);
 
     addr_destroy(if_hw);
     addr_destroy(if_ip);
     packet_destroy(p);
 
-    return resp;
+    return probe;
+}
+
+static struct addr *neighbor4_reply(const struct probe *probe) {
+    if (probe->response_len == 0) return NULL;
+    struct arp_hdr *r_arp = (struct arp_hdr *)(probe->response + ETH_H_SIZE);
+    return addr_create(ADDR_ETHERNET, r_arp->sender_hw);
 }
 
 static int neighbor6_match(const uint8_t *probe, uint32_t probe_len,
@@ -152,13 +154,13 @@ static int neighbor6_match(const uint8_t *probe, uint32_t probe_len,
     return 0;
 }
 
-static struct addr *neighbor6(struct mt *a, const struct addr *addr,
-                              int if_index) {
+static struct probe *neighbor6_send(struct mt *a, const struct addr *addr,
+                                    int if_index) {
 
-    struct addr *if_hw = iface_hw_addr(if_index);
+    struct addr *if_hw = mt_iface_hw_addr(a, if_index);
     if (if_hw == NULL) return NULL;
 
-    struct addr *if_ip = iface_ip_addr(if_index, addr->type);
+    struct addr *if_ip = mt_iface_ip_addr(a, if_index, addr->type);
     if (if_ip == NULL) {
         addr_destroy(if_hw);
         return NULL;
@@ -166,38 +168,185 @@ static struct addr *neighbor6(struct mt *a, const struct addr *addr,
 
     struct packet *p = neighbor6_packet(if_hw->addr, if_ip->addr, addr->addr);
 
-    mt_send(a, if_index, p->buf, p->length, &neighbor6_match);
-    mt_wait(a, if_index);
+    struct probe *probe = mt_send(a, if_index, p->buf, p->length,
+                                  &neighbor6_match);
 
-    struct addr *resp = NULL;
+    addr_destroy(if_hw);
+    addr_destroy(if_ip);
+    packet_destroy(p);
 
-    struct interface *i = mt_get_interface(a, if_index);
-    while (i->probes->count > 0) {
-        struct probe *probe = (struct probe *)list_pop(i->probes);
-        if (probe->response_len > 0) {
+    return probe;
+}
+
+static struct addr *neighbor6_reply(const struct probe *probe) {
+    if (probe->response_len == 0) return NULL;
 
-            uint32_t icmp_opt_pos = ETH_H_SIZE + IPV6_H_SIZE +
-                                    ICMPV6_H_SIZE + 16;
+    uint32_t icmp_opt_pos = ETH_H_SIZE + IPV6_H_SIZE +
+                            ICMPV6_H_SIZE + 16;
 
-            uint8_t *icmp_opt = (uint8_t *)(probe->response + icmp_opt_pos);
+    uint8_t *icmp_opt = (uint8_t *)(probe->response + icmp_opt_pos);
 
-            resp = addr_create(ADDR_ETHERNET, icmp_opt+2);
+    return addr_create(ADDR_ETHERNET, icmp_opt+2);
+}
+
+// Reads a valid RTM_NEWNEIGH entry of family, NULL fields when it is not
+static void neighbor_entry(struct nlmsghdr *msg, int family, int *if_index,
+                           const uint8_t **dst, const uint8_t **lladdr) {
+    struct ndmsg *ndmsg = NLMSG_DATA(msg);
+    int addr_len = (family == AF_INET) ? 4 : 16;
+    *dst = NULL;
+    *lladdr = NULL;
+    if (ndmsg->ndm_family != family) return;
+    if ((ndmsg->ndm_state & MT_ND_VALID) == 0) return;
+    *if_index = ndmsg->ndm_ifindex;
+
+    int len = msg->nlmsg_len - NLMSG_LENGTH(sizeof(*ndmsg));
+    struct rtattr *rta = NULL;
+    for (rta = (struct rtattr *)((uint8_t *)ndmsg + NLMSG_ALIGN(sizeof(*ndmsg)));
+         RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == NDA_DST && RTA_PAYLOAD(rta) == addr_len) {
+            *dst = RTA_DATA(rta);
+        } else if (rta->rta_type == NDA_LLADDR && RTA_PAYLOAD(rta) == 6) {
+            *lladdr = RTA_DATA(rta);
         }
-        probe_destroy(probe);
     }
+    if (*dst == NULL) *lladdr = NULL;
+}
 
-    addr_destroy(if_hw);
-    addr_destroy(if_ip);
-    packet_destroy(p);
+// Keys of the table: the interface followed by the address
+static uint32_t neighbor_key(uint8_t *key, int if_index, const uint8_t *dst,
+                             int addr_len) {
+    memcpy(key, &if_index, sizeof(if_index));
+    memcpy(key + sizeof(if_index), dst, addr_len);
+    return sizeof(if_index) + addr_len;
+}
 
-    return resp;
+static void neighbor_table_free(const void *key, uint32_t key_len, void *data,
+                                void *ctx) {
+    addr_destroy((struct addr *)data);
 }
 
+/* Dumps the valid entries of the kernel neighbor table of one address
+ * type with a single RTM_GETNEIGH. A dump reads the whole table, so many
+ * lookups are answered from one.
+ */
+struct hash *mt_nd_table_create(int type) {
+    int family = (type == ADDR_IPV4) ? AF_INET : AF_INET6;
+    int addr_len = (type == ADDR_IPV4) ? 4 : 16;
+    uint8_t msg_buf[NLMSG_SPACE(sizeof(struct ndmsg))];
+    memset(msg_buf, 0, sizeof(msg_buf));
+
+    struct nlmsghdr *msg = (struct nlmsghdr *)msg_buf;
+    msg->nlmsg_len   = NLMSG_LENGTH(sizeof(struct ndmsg));
+    msg->nlmsg_type  = RTM_GETNEIGH;
+    msg->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    msg->nlmsg_seq   = 1;
+    msg->nlmsg_pid   = getpid();
+
+    struct ndmsg *ndmsg = NLMSG_DATA(msg);
+    ndmsg->ndm_family = family;
+
+    int fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
+    if (fd == -1) return NULL;
+
+    uint8_t *recv_buf = NULL;
+    struct hash *t = hash_create(0);
+    if (t == NULL) goto fail;
+    if (send(fd, msg_buf, msg->nlmsg_len, 0) == -1) goto fail;
+    recv_buf = malloc(NEIGH_DUMPBUF);
+    if (recv_buf == NULL) goto fail;
+
+    int done = 0;
+    while (done == 0) {
+        int len = recv(fd, recv_buf, NEIGH_DUMPBUF, 0);
+        if (len <= 0) break;
+
+        struct nlmsghdr *resp = (struct nlmsghdr *)recv_buf;
+        for (; NLMSG_OK(resp, len); resp = NLMSG_NEXT(resp, len)) {
+            if (resp->nlmsg_type == NLMSG_DONE ||
+                resp->nlmsg_type == NLMSG_ERROR) {
+                done = 1;
+                break;
+            }
+            if (resp->nlmsg_type != RTM_NEWNEIGH) continue;
+
+            int if_index = 0;
+            const uint8_t *dst = NULL;
+            const uint8_t *lladdr = NULL;
+            neighbor_entry(resp, family, &if_index, &dst, &lladdr);
+            if (lladdr == NULL) continue;
+
+            uint8_t key[sizeof(int) + 16];
+            uint32_t key_len = neighbor_key(key, if_index, dst, addr_len);
+            if (hash_get(t, key, key_len) != NULL) continue;
+            struct addr *hw_addr = addr_create(ADDR_ETHERNET, lladdr);
+            if (hw_addr == NULL) continue;
+            if (hash_put(t, key, key_len, hw_addr) == -1) addr_destroy(hw_addr);
+        }
+    }
+
+    free(recv_buf);
+    close(fd);
+    return t;
+
+fail:
+    if (t != NULL) mt_nd_table_destroy(t);
+    free(recv_buf);
+    close(fd);
+    return NULL;
+}
+
+void mt_nd_table_destroy(struct hash *t) {
+    hash_fn(t, &neighbor_table_free, NULL);
+    hash_destroy(t);
+}
+
+// A copy of the hardware address of addr on the interface, if the table has it
+struct addr *mt_nd_table_lookup(const struct hash *t, const struct addr *addr,
+                                int if_index) {
+    int addr_len = (addr->type == ADDR_IPV4) ? 4 : 16;
+    uint8_t key[sizeof(int) + 16];
+    uint32_t key_len = neighbor_key(key, if_index, addr->addr, addr_len);
+    const struct addr *hw_addr = hash_get(t, key, key_len);
+    return (hw_addr != NULL) ? addr_copy(hw_addr) : NULL;
+}
+
+// Looks addr up in the kernel neighbor table
+struct addr *mt_nd_kernel(const struct addr *addr, int if_index) {
+    struct hash *t = mt_nd_table_create(addr->type);
+    if (t == NULL) return NULL;
+    struct addr *hw_addr = mt_nd_table_lookup(t, addr, if_index);
+    mt_nd_table_destroy(t);
+    return hw_addr;
+}
+
+// The kernel usually knows the neighbor already, ARP and ND are only used
+// for missing or stale entries
 struct addr *mt_nd(struct mt *a, const struct addr *addr, int if_index) {
+    struct addr *hw_addr = mt_nd_kernel(addr, if_index);
+    if (hw_addr != NULL) return hw_addr;
+
+    struct probe *probe = mt_nd_send(a, addr, if_index);
+    if (probe == NULL) return NULL;
+    mt_wait_probe(a, if_index, probe);
+    hw_addr = mt_nd_reply(addr, probe);
+    probe_destroy(probe);
+    return hw_addr;
+}
+
+// Sends an ARP request or a neighbor solicitation without waiting, the
+// probe stays on the interface until the caller takes it out
+struct probe *mt_nd_send(struct mt *a, const struct addr *addr, int if_index) {
     if (addr->type == ADDR_IPV4) {
-        return neighbor4(a, addr, if_index);
+        return neighbor4_send(a, addr, if_index);
     } else if (addr->type == ADDR_IPV6) {
-        return neighbor6(a, addr, if_index);
+        return neighbor6_send(a, addr, if_index);
     }
     return NULL;
 }
+
+struct addr *mt_nd_reply(const struct addr *addr, const struct probe *probe) {
+    if (addr->type == ADDR_IPV4) return neighbor4_reply(probe);
+    if (addr->type == ADDR_IPV6) return neighbor6_reply(probe);
+    return NULL;
+}
@@ -29,9 +29,23 @@
 #ifndef __NEIGHBOUR_H__
 #define __NEIGHBOUR_H__
 
+#include <linux/neighbour.h>
+
 #include "mt.h"
 #include "addr.h"
+#include "hash.h"
+
+// Kernel neighbor entries usable without asking the neighbor again, stale
+// ones and those the kernel is verifying are resolved actively
+#define MT_ND_VALID (NUD_REACHABLE | NUD_PERMANENT | NUD_NOARP)
 
 struct addr *mt_nd(struct mt *a, const struct addr *addr, int if_index);
+struct addr *mt_nd_kernel(const struct addr *addr, int if_index);
+struct hash *mt_nd_table_create(int type);
+void mt_nd_table_destroy(struct hash *t);
+struct addr *mt_nd_table_lookup(const struct hash *t, const struct addr *addr,
+                                int if_index);
+struct probe *mt_nd_send(struct mt *a, const struct addr *addr, int if_index);
+struct addr *mt_nd_reply(const struct addr *addr, const struct probe *probe);
 
 #endif
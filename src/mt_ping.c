@@ -29,6 +29,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <string.h>
 #include <arpa/inet.h>
 
 #include "packet.h"
@@ -44,15 +46,52 @@
 #include "util.h"
 #include "match.h"
 #include "buffer.h"
+#include "list.h"
+#include "histogram.h"
+#include "sched.h"
 #include "mt_ping.h"
 
 #define IP_ID    54321
 #define CHECKSUM 54321
-#define ICMP_ID  54321
+
+// Echo ids of ping targets, below the ones traceroute (54321), sweep
+// (0xd4xx) and MDA (0xffff) send, so replies of a batch never mix
+#define PING_ICMP_ID_FIRST 0x0100
+#define PING_ICMP_ID_LAST  0xd3ff
+
+struct ping {
+    struct dst *dst;
+    int own_dst;
+    uint16_t icmp_id;         // tells apart the echoes of each target
+    int n;                    // echoes to send, 0 to run until SIGINT
+    struct timespec interval; // between two echoes
+    int period;               // seconds between summaries, 0 prints replies
+    int sent;
+    int received;
+    struct timespec next;
+    struct timespec report;
+    struct histogram *rtt; // microseconds, whole run
+    struct histogram *period_rtt;
+    int period_lost;
+};
+
+static int ping_next_id = -1;
+
+// Starts at an offset of the pid, so pings of two processes rarely share
+// an id, and wraps within the range
+static uint16_t ping_icmp_id(void) {
+    int range = PING_ICMP_ID_LAST - PING_ICMP_ID_FIRST + 1;
+    if (ping_next_id == -1) ping_next_id = getpid() % range;
+    uint16_t id = PING_ICMP_ID_FIRST + ping_next_id;
+    ping_next_id = (ping_next_id + 1) % range;
+    return id;
+}
 
 static void ping4_print(const struct probe *p) {
     if (p->response_len == 0) {
-        printf("*\n");
+        char *addr = get_ip4_dst_addr(p->probe);
+        printf("* %s: icmp_seq=%d\n", addr, get_icmp4_seqnum(p->probe));
+        free(addr);
         return;
     }
 
@@ -68,7 +107,9 @@ static void ping4_print(const struct probe *p) {
 
 static void ping6_print(const struct probe *p) {
     if (p->response_len == 0) {
-        printf("*\n");
+        char *addr = get_ip6_dst_addr(p->probe);
+        printf("* %s: icmp_seq=%d\n", addr, get_icmp6_seqnum(p->probe));
+        free(addr);
         return;
     }
 
@@ -83,41 +124,196 @@ static void ping6_print(const struct probe *p) {
     free(time);
 }
 
-int mt_ping(struct mt *a, const struct dst *dst, int n) {
-    if (dst->ip_dst->type != ADDR_IPV4 &&
-        dst->ip_dst->type != ADDR_IPV6) return -1;
-
-    int probe_c = 0;
-    for (probe_c = 1; probe_c <= n; probe_c++) {
-        struct packet *p = NULL;
-
-        if (dst->ip_dst->type == ADDR_IPV4) {
-            p = packet_helper_echo4(dst->mac_dst->addr, dst->mac_src->addr,
-                                    dst->ip_src->addr, dst->ip_dst->addr,
-                                    IP_ID + probe_c, IPV4_TTL, ICMP_ID,
-                                    probe_c, CHECKSUM);
-            mt_send(a, dst->if_index, p->buf, p->length, &match_icmp4);
-        } else if (dst->ip_dst->type == ADDR_IPV6) {
-            p = packet_helper_echo6(dst->mac_dst->addr, dst->mac_src->addr,
-                              dst->ip_src->addr, dst->ip_dst->addr,
-                              0, 0, IPV6_HOP_LIMIT, ICMP_ID, probe_c, CHECKSUM);
-            mt_send(a, dst->if_index, p->buf, p->length, &match_icmp6);
-        }
-        
-        mt_wait(a, dst->if_index);
+static int ping_finished(struct sched *s, struct task *t) {
+    const struct ping *ping = (const struct ping *)t->data;
+    if (sched_interrupted()) return 1;
+    return ping->n > 0 && ping->sent == ping->n;
+}
+
+static void ping_print_period(const struct ping *ping,
+                              const struct timespec *now) {
+    const struct histogram *h = ping->period_rtt;
+    char addr[INET6_ADDRSTRLEN];
+    int af = (ping->dst->ip_dst->type == ADDR_IPV4) ? AF_INET : AF_INET6;
+    inet_ntop(af, ping->dst->ip_dst->addr, addr, sizeof(addr));
+    printf("%s %ld answered=%u lost=%d p50=%.3f p90=%.3f p99=%.3f max=%.3f\n",
+           addr, (long)now->tv_sec, h->count, ping->period_lost,
+           histogram_percentile(h, 50) / 1000.0,
+           histogram_percentile(h, 90) / 1000.0,
+           histogram_percentile(h, 99) / 1000.0, h->max / 1000.0);
+}
+
+// Sends the next echo once it is due, keeping to the interval even if a
+// send was late, and prints the period summaries on the way
+static int ping_send(struct sched *s, struct task *t, struct timespec *wake) {
+    struct ping *ping = (struct ping *)t->data;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    if (ping->sent == 0) {
+        struct timespec period_ts = timespec_from_ms(ping->period * 1000);
+        ping->next = now;
+        ping->report = timespec_add(&now, &period_ts);
+    }
 
-        struct interface *i = mt_get_interface(a, dst->if_index);
-        struct probe *probe = (struct probe *)list_pop(i->probes);
-        
-        if (dst->ip_dst->type == ADDR_IPV4) {
+    if (ping->period > 0 && timespec_cmp(&now, &ping->report) != -1) {
+        struct timespec period_ts = timespec_from_ms(ping->period * 1000);
+        ping_print_period(ping, &now);
+        fflush(stdout);
+        histogram_reset(ping->period_rtt);
+        ping->period_lost = 0;
+        ping->report = timespec_add(&ping->report, &period_ts);
+    }
+
+    if (ping_finished(s, t)) return 0;
+    if (timespec_cmp(&now, &ping->next) == -1) {
+        if (timespec_cmp(&ping->next, wake) == -1) *wake = ping->next;
+        return 0;
+    }
+
+    const struct dst *dst = ping->dst;
+    struct packet *p = NULL;
+    struct probe *probe = NULL;
+    uint16_t seq = (ping->sent % 0xffff) + 1;
+
+    if (dst->ip_dst->type == ADDR_IPV4) {
+        p = packet_helper_echo4(dst->mac_dst->addr, dst->mac_src->addr,
+                                dst->ip_src->addr, dst->ip_dst->addr,
+                                IPV4_TTL, IP_ID + seq, ping->icmp_id,
+                                seq, CHECKSUM);
+        probe = sched_send(s, t, dst->if_index, p->buf, p->length,
+                           &match_icmp4);
+    } else if (dst->ip_dst->type == ADDR_IPV6) {
+        p = packet_helper_echo6(dst->mac_dst->addr, dst->mac_src->addr,
+                          dst->ip_src->addr, dst->ip_dst->addr,
+                          0, 0, IPV6_HOP_LIMIT, ping->icmp_id, seq, CHECKSUM);
+        probe = sched_send(s, t, dst->if_index, p->buf, p->length,
+                           &match_icmp6);
+    }
+    packet_destroy(p);
+
+    // An echo not answered within the wait is lost, not sent again
+    if (probe != NULL) mt_send_once(s->mt, probe);
+
+    ping->sent++;
+    ping->next = timespec_add(&ping->next, &ping->interval);
+    return 1;
+}
+
+static void ping_receive(struct sched *s, struct task *t,
+                         struct probe *probe) {
+    struct ping *ping = (struct ping *)t->data;
+
+    if (ping->period == 0) {
+        if (ping->dst->ip_dst->type == ADDR_IPV4) {
             ping4_print(probe);
-        } else if (dst->ip_dst->type == ADDR_IPV6) {
+        } else if (ping->dst->ip_dst->type == ADDR_IPV6) {
             ping6_print(probe);
         }
+    }
 
+    if (probe->response_len == 0) {
+        ping->period_lost++;
         probe_destroy(probe);
-        packet_destroy(p);     
+        return;
+    }
+
+    // Echoes are sent once, the RTT of one sent again would be ambiguous
+    if (probe->retries == 0) {
+        struct timespec d = timespec_diff(&probe->response_time,
+                                          &probe->sent_time);
+        uint64_t us = (uint64_t)d.tv_sec * 1000000 + d.tv_nsec / 1000;
+        if (us > UINT32_MAX) us = UINT32_MAX;
+        histogram_add(ping->rtt, us);
+        histogram_add(ping->period_rtt, us);
+    }
+    ping->received++;
+    probe_destroy(probe);
+}
+
+static void ping_print_summary(const struct ping *ping) {
+    char *addr = addr_to_str(ping->dst->ip_dst);
+    int loss = (ping->sent > 0) ?
+               (ping->sent - ping->received) * 100 / ping->sent : 0;
+    printf("# %s sent=%d received=%d loss=%d%%", addr, ping->sent,
+           ping->received, loss);
+    if (ping->received > 0) {
+        const struct histogram *h = ping->rtt;
+        printf(" min/avg/max=%.3f/%.3f/%.3f ms", h->min / 1000.0,
+               (double)h->sum / h->count / 1000.0, h->max / 1000.0);
+    }
+    printf("\n");
+    fflush(stdout);
+    free(addr);
+}
+
+static void ping_free(struct ping *ping) {
+    if (ping->rtt != NULL) histogram_destroy(ping->rtt);
+    if (ping->period_rtt != NULL) histogram_destroy(ping->period_rtt);
+    if (ping->own_dst) dst_destroy(ping->dst);
+    free(ping);
+}
+
+static void ping_destroy(struct task *t) {
+    struct ping *ping = (struct ping *)t->data;
+    ping_print_summary(ping);
+    ping_free(ping);
+}
+
+struct task *ping_task_create(struct dst *dst, int own_dst, int n,
+                              int interval_us, int period) {
+    if (dst->ip_dst->type != ADDR_IPV4 &&
+        dst->ip_dst->type != ADDR_IPV6) return NULL;
+
+    struct ping *ping = malloc(sizeof(*ping));
+    if (ping == NULL) return NULL;
+    memset(ping, 0, sizeof(*ping));
+
+    ping->dst = dst;
+    ping->icmp_id = ping_icmp_id();
+    ping->n = n;
+    ping->period = period;
+    ping->interval.tv_sec = interval_us / 1000000;
+    ping->interval.tv_nsec = (interval_us % 1000000) * 1000;
+    ping->rtt = histogram_create();
+    ping->period_rtt = histogram_create();
+
+    struct task *t = NULL;
+    if (ping->rtt != NULL && ping->period_rtt != NULL) {
+        t = task_create(&ping_send, &ping_receive, &ping_finished,
+                        &ping_destroy, ping);
+    }
+    if (t == NULL) {
+        ping_free(ping);
+        return NULL;
+    }
+    ping->own_dst = own_dst;
+    t->if_index = dst->if_index;
+    return t;
+}
+
+/* Every destination is a task of its own on a scheduler, so echoes to all
+ * of them are kept in flight together: each gets one every interval, sends
+ * are paced by the send wait, and a slow destination does not hold back
+ * the others.
+ */
+int mt_ping(struct mt *a, struct list *dsts, int n, int interval_us,
+            int period) {
+    struct list_item *it = NULL;
+    for (it = dsts->first; it != NULL; it = it->next) {
+        const struct dst *dst = (const struct dst *)it->data;
+        if (dst->ip_dst->type != ADDR_IPV4 &&
+            dst->ip_dst->type != ADDR_IPV6) return -1;
+    }
+
+    struct sched *s = sched_create(a, dsts->count);
+    if (s == NULL) return -1;
+
+    for (it = dsts->first; it != NULL; it = it->next) {
+        sched_add(s, ping_task_create((struct dst *)it->data, 0, n,
+                                      interval_us, period));
     }
 
+    sched_destroy(s);
     return 0;
 }
@@ -31,7 +31,13 @@
 
 #include "mt.h"
 #include "dst.h"
+#include "sched.h"
 
-int mt_ping(struct mt *a, const struct dst *dst, int n);
+// Pings dst on a scheduler, destroying it at the end if own_dst is set
+struct task *ping_task_create(struct dst *dst, int own_dst, int n,
+                              int interval_us, int period);
+
+int mt_ping(struct mt *a, struct list *dsts, int n, int interval_us,
+            int period);
 
 #endif // __MT_PING_H__
@@ -0,0 +1,463 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "args.h"
+#include "packet.h"
+#include "pdu_eth.h"
+#include "pdu_ipv4.h"
+#include "pdu_icmpv4.h"
+#include "pdu_ipv6.h"
+#include "pdu_icmpv6.h"
+#include "pdu_udp.h"
+#include "pdu_tcp.h"
+#include "protocol_numbers.h"
+#include "packet_helper.h"
+#include "util.h"
+#include "dst.h"
+#include "mt_sweep.h"
+
+/* Stateless sweep: nothing is kept per probe. The ttl and the send time
+ * travel in header fields that come back in the reply (or in the header
+ * the ICMP error quotes), and the target is the quoted destination:
+ *
+ *   icmp: echo id = SWEEP_ICMP_MAGIC << 8 | ttl, seq = send time
+ *   udp:  source port = SWEEP_SPORT + ttl, checksum = send time
+ *   tcp:  source port = SWEEP_SPORT + ttl, sequence number = send time
+ *
+ * 16 bit send times are milliseconds since the start of the sweep modulo
+ * SWEEP_TS_MOD, plus one so a UDP checksum is never zero.
+ */
+
+#define SWEEP_IP_ID        54321
+#define SWEEP_CHECKSUM     54321
+#define SWEEP_ICMP_MAGIC   0xd4
+#define SWEEP_SPORT        43435
+#define SWEEP_DPORT        33435
+#define SWEEP_TCP_DPORT    80
+#define SWEEP_TS_MOD       0xffff
+#define SWEEP_PERM_BITS    63 // of the (target, ttl) pairs permuted
+#define SWEEP_DISPATCH_EACH 64
+
+struct sweep {
+    struct mt *mt;
+    struct dst *dst; // route, source and next hop used for the whole prefix
+    int type;
+    int size;
+    uint8_t base[ADDR_IPV6_SIZE];
+    int host_bits;
+    int probe_type;
+    int max_ttl;
+    struct timespec start;
+    int replies;
+};
+
+// Full period LCG over a power of two, mixed by bijections and walked
+// until it falls inside [0, n): a random permutation in constant memory
+struct sweep_perm {
+    uint64_t x;
+    uint64_t a;
+    uint64_t c;
+    uint64_t mask;
+    uint64_t n;
+    uint64_t left;
+    int shift;
+};
+
+static void sweep_perm_init(struct sweep_perm *p, uint64_t n, uint64_t seed) {
+    int bits = 0;
+    while (bits < 63 && ((uint64_t)1 << bits) < n) bits++;
+    p->mask  = ((uint64_t)1 << bits) - 1;
+    p->n     = n;
+    p->left  = p->mask + 1;
+    p->shift = bits / 2 + 1;
+    p->a     = ((seed << 2) | 1) & p->mask;
+    p->c     = ((seed >> 17) | 1) & p->mask;
+    p->x     = (seed >> 7) & p->mask;
+    if (p->a == 0) p->a = 1;
+}
+
+static int sweep_perm_next(struct sweep_perm *p, uint64_t *v) {
+    while (p->left > 0) {
+        p->left--;
+        p->x = (p->a * p->x + p->c) & p->mask;
+        uint64_t y = (p->x * 0x9e3779b97f4a7c15ULL) & p->mask;
+        y ^= y >> p->shift;
+        if (y < p->n) {
+            *v = y;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t sweep_ms(const struct sweep *s, const struct timespec *t) {
+    struct timespec d = timespec_diff(t, &s->start);
+    return (uint32_t)(d.tv_sec * 1000 + d.tv_nsec / 1000000);
+}
+
+static uint16_t sweep_ts16(uint32_t ms) {
+    return (ms % SWEEP_TS_MOD) + 1;
+}
+
+// Host bits of the sweep that fall in a byte of the address
+static uint8_t sweep_host_mask(const struct sweep *s, int byte) {
+    int low = (s->size - 1 - byte) * 8;
+    int n = s->host_bits - low;
+    if (n <= 0) return 0;
+    if (n >= 8) return 0xff;
+    return (1 << n) - 1;
+}
+
+static void sweep_target(const struct sweep *s, uint64_t index, uint8_t *addr) {
+    int b = 0;
+    for (b = 0; b < s->size; b++) {
+        uint8_t m = sweep_host_mask(s, b);
+        int shift = (s->size - 1 - b) * 8;
+        addr[b] = s->base[b];
+        if (m != 0 && shift < 64) addr[b] |= (index >> shift) & m;
+    }
+}
+
+static int sweep_in_prefix(const struct sweep *s, const uint8_t *addr) {
+    int b = 0;
+    for (b = 0; b < s->size; b++) {
+        if ((addr[b] & ~sweep_host_mask(s, b)) != s->base[b]) return 0;
+    }
+    return 1;
+}
+
+static void sweep_send(struct sweep *s, const uint8_t *target, int ttl) {
+    struct dst *d = s->dst;
+    struct packet *p = NULL;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint32_t ms = sweep_ms(s, &now);
+    uint16_t icmp_id = (SWEEP_ICMP_MAGIC << 8) | ttl;
+
+    if (s->type == ADDR_IPV4) {
+        if (s->probe_type == METHOD_ICMP) {
+            p = packet_helper_echo4(d->mac_dst->addr, d->mac_src->addr,
+                                    d->ip_src->addr, target, ttl, SWEEP_IP_ID,
+                                    icmp_id, sweep_ts16(ms), SWEEP_CHECKSUM);
+        } else if (s->probe_type == METHOD_UDP) {
+            p = packet_helper_udp4(d->mac_dst->addr, d->mac_src->addr,
+                                   d->ip_src->addr, target, ttl, SWEEP_IP_ID,
+                                   SWEEP_SPORT + ttl, SWEEP_DPORT, sweep_ts16(ms));
+        } else if (s->probe_type == METHOD_TCP) {
+            p = packet_helper_tcp4(d->mac_dst->addr, d->mac_src->addr,
+                                   d->ip_src->addr, target, ttl, SWEEP_IP_ID,
+                                   SWEEP_SPORT + ttl, SWEEP_TCP_DPORT, ms);
+        }
+    } else if (s->type == ADDR_IPV6) {
+        if (s->probe_type == METHOD_ICMP) {
+            p = packet_helper_echo6(d->mac_dst->addr, d->mac_src->addr,
+                                    d->ip_src->addr, target, 0, 0, ttl,
+                                    icmp_id, sweep_ts16(ms), SWEEP_CHECKSUM);
+        } else if (s->probe_type == METHOD_UDP) {
+            p = packet_helper_udp6(d->mac_dst->addr, d->mac_src->addr,
+                                   d->ip_src->addr, target, 0, 0, ttl,
+                                   SWEEP_SPORT + ttl, SWEEP_DPORT, sweep_ts16(ms));
+        } else if (s->probe_type == METHOD_TCP) {
+            p = packet_helper_tcp6(d->mac_dst->addr, d->mac_src->addr,
+                                   d->ip_src->addr, target, 0, 0, ttl,
+                                   SWEEP_SPORT + ttl, SWEEP_TCP_DPORT, ms);
+        }
+    }
+
+    if (p == NULL) return;
+    mt_send_raw(s->mt, d->if_index, p->buf, p->length);
+    packet_destroy(p);
+}
+
+/* Recovers the ttl and send time from a probe header, either the one an
+ * ICMP error quotes or an echo reply (same id and sequence). mod is the
+ * modulus of the send time, zero when it is the full 32 bit milliseconds.
+ */
+static int sweep_decode_probe(const struct sweep *s, int proto,
+                              const uint8_t *l4, int *ttl, uint32_t *sent,
+                              uint32_t *mod) {
+    if (s->probe_type == METHOD_ICMP &&
+        (proto == PROTO_ICMPV4 || proto == PROTO_ICMPV6)) {
+        uint16_t id = ntohs(*(const uint16_t *)(l4 + 4));
+        if ((id >> 8) != SWEEP_ICMP_MAGIC) return -1;
+        *ttl  = id & 0xff;
+        *sent = ntohs(*(const uint16_t *)(l4 + 6));
+        *mod  = SWEEP_TS_MOD;
+    } else if (s->probe_type == METHOD_UDP && proto == PROTO_UDP) {
+        const struct udp_hdr *udp = (const struct udp_hdr *)l4;
+        if (ntohs(udp->dst_port) != SWEEP_DPORT) return -1;
+        *ttl  = ntohs(udp->src_port) - SWEEP_SPORT;
+        *sent = ntohs(udp->checksum);
+        *mod  = SWEEP_TS_MOD;
+    } else if (s->probe_type == METHOD_TCP && proto == PROTO_TCP) {
+        const struct tcp_hdr *tcp = (const struct tcp_hdr *)l4;
+        if (ntohs(tcp->dst_port) != SWEEP_TCP_DPORT) return -1;
+        *ttl  = ntohs(tcp->src_port) - SWEEP_SPORT;
+        *sent = ntohl(tcp->seq_numb);
+        *mod  = 0;
+    } else {
+        return -1;
+    }
+    return (*ttl >= 1 && *ttl <= s->max_ttl) ? 0 : -1;
+}
+
+// A SYN-ACK or RST from the target itself acknowledges the sequence number
+static int sweep_decode_tcp_reply(const struct sweep *s, const uint8_t *l4,
+                                  int *ttl, uint32_t *sent, uint32_t *mod) {
+    if (s->probe_type != METHOD_TCP) return -1;
+    const struct tcp_hdr *tcp = (const struct tcp_hdr *)l4;
+    if (ntohs(tcp->src_port) != SWEEP_TCP_DPORT) return -1;
+    *ttl  = ntohs(tcp->dst_port) - SWEEP_SPORT;
+    *sent = ntohl(tcp->ack_numb) - 1;
+    *mod  = 0;
+    return (*ttl >= 1 && *ttl <= s->max_ttl) ? 0 : -1;
+}
+
+static int sweep_decode4(const struct sweep *s, const uint8_t *ip, uint32_t len,
+                         const uint8_t **target, const uint8_t **hop,
+                         int *ttl, uint32_t *sent, uint32_t *mod) {
+    if (len < IPV4_H_SIZE + ICMPV4_H_SIZE) return -1;
+    const struct ipv4_hdr *rip = (const struct ipv4_hdr *)ip;
+    const uint8_t *l4 = ip + IPV4_H_SIZE;
+    *hop = (const uint8_t *)&rip->src_addr;
+
+    if (rip->protocol == PROTO_TCP) {
+        if (len < IPV4_H_SIZE + sizeof(struct tcp_hdr)) return -1;
+        *target = *hop;
+        return sweep_decode_tcp_reply(s, l4, ttl, sent, mod);
+    }
+    if (rip->protocol != PROTO_ICMPV4) return -1;
+
+    const struct icmpv4_hdr *icmp = (const struct icmpv4_hdr *)l4;
+    if (icmp->type == ICMPV4_TYPE_ECHOREPLY) {
+        *target = *hop;
+        return sweep_decode_probe(s, PROTO_ICMPV4, l4, ttl, sent, mod);
+    }
+    if (icmp->type != ICMPV4_TYPE_EXCEEDED &&
+        icmp->type != ICMPV4_TYPE_UNREACH) return -1;
+
+    // The quote holds at least the first 8 bytes of the probe transport
+    if (len < 2 * IPV4_H_SIZE + ICMPV4_H_SIZE + 8) return -1;
+    const struct ipv4_hdr *inner = (const struct ipv4_hdr *)(l4 + ICMPV4_H_SIZE);
+    *target = (const uint8_t *)&inner->dst_addr;
+    return sweep_decode_probe(s, inner->protocol,
+                              l4 + ICMPV4_H_SIZE + IPV4_H_SIZE, ttl, sent, mod);
+}
+
+static int sweep_decode6(const struct sweep *s, const uint8_t *ip, uint32_t len,
+                         const uint8_t **target, const uint8_t **hop,
+                         int *ttl, uint32_t *sent, uint32_t *mod) {
+    if (len < IPV6_H_SIZE + ICMPV6_H_SIZE) return -1;
+    const struct ipv6_hdr *rip = (const struct ipv6_hdr *)ip;
+    const uint8_t *l4 = ip + IPV6_H_SIZE;
+    *hop = (const uint8_t *)rip->src_addr;
+
+    if (rip->next_header == PROTO_TCP) {
+        if (len < IPV6_H_SIZE + sizeof(struct tcp_hdr)) return -1;
+        *target = *hop;
+        return sweep_decode_tcp_reply(s, l4, ttl, sent, mod);
+    }
+    if (rip->next_header != PROTO_ICMPV6) return -1;
+
+    const struct icmpv6_hdr *icmp = (const struct icmpv6_hdr *)l4;
+    if (icmp->type == ICMPV6_TYPE_ECHOREPLY) {
+        *target = *hop;
+        return sweep_decode_probe(s, PROTO_ICMPV6, l4, ttl, sent, mod);
+    }
+    if (icmp->type != ICMPV6_TYPE_EXCEEDED &&
+        icmp->type != ICMPV6_TYPE_UNREACH) return -1;
+
+    if (len < 2 * IPV6_H_SIZE + ICMPV6_H_SIZE + 8) return -1;
+    const struct ipv6_hdr *inner = (const struct ipv6_hdr *)(l4 + ICMPV6_H_SIZE);
+    *target = (const uint8_t *)inner->dst_addr;
+    return sweep_decode_probe(s, inner->next_header,
+                              l4 + ICMPV6_H_SIZE + IPV6_H_SIZE, ttl, sent, mod);
+}
+
+static void sweep_receive(const uint8_t *buf, uint32_t len,
+                          const struct timespec *ts, void *ctx) {
+    struct sweep *s = (struct sweep *)ctx;
+    if (len < ETH_H_SIZE) return;
+    const struct eth_hdr *eth = (const struct eth_hdr *)buf;
+
+    const uint8_t *target = NULL;
+    const uint8_t *hop = NULL;
+    int ttl = 0;
+    uint32_t sent = 0;
+    uint32_t mod = 0;
+    int r = -1;
+
+    if (s->type == ADDR_IPV4 && ntohs(eth->type) == ETH_TYPE_IPV4) {
+        r = sweep_decode4(s, buf + ETH_H_SIZE, len - ETH_H_SIZE,
+                          &target, &hop, &ttl, &sent, &mod);
+    } else if (s->type == ADDR_IPV6 && ntohs(eth->type) == ETH_TYPE_IPV6) {
+        r = sweep_decode6(s, buf + ETH_H_SIZE, len - ETH_H_SIZE,
+                          &target, &hop, &ttl, &sent, &mod);
+    }
+    if (r != 0 || sweep_in_prefix(s, target) == 0) return;
+
+    uint32_t now = sweep_ms(s, ts);
+    uint32_t rtt = 0;
+    if (mod == 0) {
+        rtt = now - sent;
+    } else {
+        rtt = (sweep_ts16(now) + mod - sent) % mod;
+    }
+
+    char target_str[INET6_ADDRSTRLEN];
+    char hop_str[INET6_ADDRSTRLEN];
+    int af = (s->type == ADDR_IPV4) ? AF_INET : AF_INET6;
+    inet_ntop(af, target, target_str, sizeof(target_str));
+    inet_ntop(af, hop, hop_str, sizeof(hop_str));
+    printf("%s %d %s %u\n", target_str, ttl, hop_str, rtt);
+    s->replies++;
+}
+
+// ADDRESS[/len], the whole prefix is swept
+static int sweep_parse(struct sweep *s, const char *prefix) {
+    char addr_str[INET6_ADDRSTRLEN + 4];
+    if (strlen(prefix) >= sizeof(addr_str)) return -1;
+    strcpy(addr_str, prefix);
+
+    int len = -1;
+    char *slash = strchr(addr_str, '/');
+    if (slash != NULL) {
+        *slash = 0;
+        char *end = NULL;
+        len = strtol(slash + 1, &end, 10);
+        if (*end != 0 || end == slash + 1) return -1;
+    }
+
+    if (inet_pton(AF_INET, addr_str, s->base) == 1) {
+        s->type = ADDR_IPV4;
+        s->size = ADDR_IPV4_SIZE;
+    } else if (inet_pton(AF_INET6, addr_str, s->base) == 1) {
+        s->type = ADDR_IPV6;
+        s->size = ADDR_IPV6_SIZE;
+    } else {
+        return -1;
+    }
+
+    int bits = s->size * 8;
+    if (len == -1) len = bits;
+    if (len < 0 || len > bits) return -1;
+    s->host_bits = bits - len;
+
+    int b = 0;
+    for (b = 0; b < s->size; b++) s->base[b] &= ~sweep_host_mask(s, b);
+    return 0;
+}
+
+static void sweep_print_summary(const char *prefix, uint64_t targets,
+                                int probes, int replies) {
+    printf("# %s targets=%llu probes=%d replies=%d\n", prefix,
+           (unsigned long long)targets, probes, replies);
+}
+
+// The (target, ttl) pairs are permuted as one 63 bit index, which bounds
+// the host bits of the prefix
+static int sweep_fits(const struct sweep *s) {
+    int ttl_bits = 0;
+    while ((1 << ttl_bits) < s->max_ttl) ttl_bits++;
+    if (s->host_bits + ttl_bits <= SWEEP_PERM_BITS) return 1;
+    printf("a sweep with -t %d covers at most %d host bits, not %d\n",
+           s->max_ttl, SWEEP_PERM_BITS - ttl_bits, s->host_bits);
+    return 0;
+}
+
+int mt_sweep(struct mt *a, const char *prefix, int probe_type, int max_ttl,
+             int rate) {
+    struct sweep s;
+    memset(&s, 0, sizeof(s));
+    s.mt = a;
+    s.probe_type = probe_type;
+    s.max_ttl = max_ttl;
+    if (max_ttl < 1 || max_ttl > 255) return -1;
+    if (sweep_parse(&s, prefix) != 0) return -1;
+    if (!sweep_fits(&s)) return -1;
+
+    struct addr *base = addr_create(s.type, s.base);
+    s.dst = dst_create(a, base);
+    if (s.dst == NULL) {
+        addr_destroy(base);
+        return -1;
+    }
+
+    int probes_start = a->probes_count;
+    uint64_t targets = (uint64_t)1 << s.host_bits;
+    struct sweep_perm perm;
+    clock_gettime(CLOCK_REALTIME, &s.start);
+    uint64_t seed = ((uint64_t)s.start.tv_nsec << 20) ^ s.start.tv_sec ^ getpid();
+    sweep_perm_init(&perm, targets * max_ttl, seed);
+
+    uint8_t target[ADDR_IPV6_SIZE];
+    uint64_t sent = 0;
+    uint64_t v = 0;
+    while (sweep_perm_next(&perm, &v)) {
+        // Keep to the rate, reading replies while ahead of it
+        while (rate > 0) {
+            struct timespec el = timespec_diff_now(&s.start);
+            uint64_t us = (uint64_t)el.tv_sec * 1000000 + el.tv_nsec / 1000;
+            if (sent < us * rate / 1000000) break;
+            if (mt_dispatch(a, s.dst->if_index, &sweep_receive, &s) <= 0) {
+                usleep(100);
+            }
+        }
+
+        sweep_target(&s, v % targets, target);
+        sweep_send(&s, target, v / targets + 1);
+        sent++;
+
+        if (sent % SWEEP_DISPATCH_EACH == 0) {
+            mt_dispatch(a, s.dst->if_index, &sweep_receive, &s);
+        }
+    }
+
+    // Replies to the last probes
+    struct timespec timeout = timespec_from_ms(a->probe_timeout * 1000);
+    struct timespec last = a->last_probe_time;
+    while (1) {
+        struct timespec el = timespec_diff_now(&last);
+        if (timespec_cmp(&el, &timeout) != -1) break;
+        if (mt_dispatch(a, s.dst->if_index, &sweep_receive, &s) <= 0) {
+            usleep(1000);
+        }
+    }
+
+    sweep_print_summary(prefix, targets, a->probes_count - probes_start,
+                        s.replies);
+    dst_destroy(s.dst);
+    return 0;
+}
@@ -48,6 +48,8 @@
 #include "util.h"
 #include "match.h"
 #include "buffer.h"
+#include "stop_set.h"
+#include "sched.h"
 #include "mt_traceroute.h"
 
 #define IP_ID     54321
@@ -85,104 +87,542 @@ static void traceroute6_print(const struct probe *p) {
     free(time);
 }
 
-static int traceroute(struct mt *a, const struct dst *dst, int probe_type,
-                      int max_ttl, int at_once) {
-    int ttl = 1;
-
-    while (ttl <= max_ttl) {
-        int pn = 0;
-        for (pn = 0; pn < at_once && ttl <= max_ttl; pn++, ttl++) {
-
-            struct packet *p = NULL;
-
-            if (dst->ip_dst->type == ADDR_IPV4) {
-                if (probe_type == METHOD_ICMP) {
-                    p = packet_helper_echo4(dst->mac_dst->addr, dst->mac_src->addr,
-                                        dst->ip_src->addr, dst->ip_dst->addr, ttl,
-                                        IP_ID + ttl, ICMP_ID, ttl, CHECKSUM);
-                    mt_send(a, dst->if_index, p->buf, p->length, &match_icmp4);
-                } else if (probe_type == METHOD_UDP) {
-                    p = packet_helper_udp4(dst->mac_dst->addr, dst->mac_src->addr,
-                                       dst->ip_src->addr, dst->ip_dst->addr, ttl,
-                                       IP_ID + ttl, SPORT, DPORT, ttl);
-                    mt_send(a, dst->if_index, p->buf, p->length, &match_udp4);
-                } else if (probe_type == METHOD_TCP) {
-                    p = packet_helper_tcp4(dst->mac_dst->addr, dst->mac_src->addr,
-                                       dst->ip_src->addr, dst->ip_dst->addr, ttl,
-                                       IP_ID + ttl, SPORT, TCP_DPORT, ttl);
-                    mt_send(a, dst->if_index, p->buf, p->length, &match_tcp4);
-                }
-            } else if (dst->ip_dst->type == ADDR_IPV6) {
-                if (probe_type == METHOD_ICMP) {
-                    p = packet_helper_echo6(dst->mac_dst->addr, dst->mac_src->addr,
-                                            dst->ip_src->addr, dst->ip_dst->addr,
-                                            0, 0, ttl, ICMP_ID, ttl, CHECKSUM);
-                    mt_send(a, dst->if_index, p->buf, p->length, &match_icmp6);
-                } else if (probe_type == METHOD_UDP) {
-                    p = packet_helper_udp6(dst->mac_dst->addr, dst->mac_src->addr,
-                                           dst->ip_src->addr, dst->ip_dst->addr, 0, 0, ttl,
-                                           SPORT, DPORT, ttl);
-                    mt_send(a, dst->if_index, p->buf, p->length, &match_udp6);
-                } else if (probe_type == METHOD_TCP) {
-                    p = packet_helper_tcp6(dst->mac_dst->addr, dst->mac_src->addr,
-                                           dst->ip_src->addr, dst->ip_dst->addr, 0, 0, ttl,
-                                           SPORT, TCP_DPORT, ttl);
-                    mt_send(a, dst->if_index, p->buf, p->length, &match_tcp6);                    
-                }
-            }
+static void traceroute_print_summary(const struct dst *dst, const char *stop,
+                                     int hops, int probes, int flows,
+                                     int balanced) {
+    char *addr_dst = addr_to_str(dst->ip_dst);
+    printf("# %s stop=%s hops=%d probes=%d", addr_dst, stop, hops, probes);
+    if (flows > 1) printf(" balanced=%d", balanced);
+    printf("\n");
+    free(addr_dst);
+}
+
+/* Each flow has its own source port, or ICMP checksum, so per-flow load
+ * balancers route its probes along one path. The low byte of the probe id
+ * is the ttl and the high one the flow, which keeps the ids of a single
+ * flow trace as they were; a low byte of zero is the distance estimate.
+ */
+#define TRACEROUTE_ID(ttl, flow) ((uint16_t)(((flow) << 8) | (ttl)))
+
+static struct probe *traceroute_send(struct sched *s, struct task *t,
+                                     const struct dst *dst, int probe_type,
+                                     int ttl, int flow, uint16_t id) {
+    struct packet *p = NULL;
+    match_fn fn = NULL;
+
+    if (dst->ip_dst->type == ADDR_IPV4) {
+        if (probe_type == METHOD_ICMP) {
+            p = packet_helper_echo4(dst->mac_dst->addr, dst->mac_src->addr,
+                                dst->ip_src->addr, dst->ip_dst->addr, ttl,
+                                IP_ID + id, ICMP_ID, id, CHECKSUM + flow);
+            fn = &match_icmp4;
+        } else if (probe_type == METHOD_UDP) {
+            p = packet_helper_udp4(dst->mac_dst->addr, dst->mac_src->addr,
+                               dst->ip_src->addr, dst->ip_dst->addr, ttl,
+                               IP_ID + id, SPORT + flow, DPORT, id);
+            fn = &match_udp4;
+        } else if (probe_type == METHOD_TCP) {
+            p = packet_helper_tcp4(dst->mac_dst->addr, dst->mac_src->addr,
+                               dst->ip_src->addr, dst->ip_dst->addr, ttl,
+                               IP_ID + id, SPORT + flow, TCP_DPORT, id);
+            fn = &match_tcp4;
+        }
+    } else if (dst->ip_dst->type == ADDR_IPV6) {
+        if (probe_type == METHOD_ICMP) {
+            p = packet_helper_echo6(dst->mac_dst->addr, dst->mac_src->addr,
+                                    dst->ip_src->addr, dst->ip_dst->addr,
+                                    0, 0, ttl, ICMP_ID, id, CHECKSUM + flow);
+            fn = &match_icmp6;
+        } else if (probe_type == METHOD_UDP) {
+            p = packet_helper_udp6(dst->mac_dst->addr, dst->mac_src->addr,
+                                   dst->ip_src->addr, dst->ip_dst->addr, 0, 0, ttl,
+                                   SPORT + flow, DPORT, id);
+            fn = &match_udp6;
+        } else if (probe_type == METHOD_TCP) {
+            p = packet_helper_tcp6(dst->mac_dst->addr, dst->mac_src->addr,
+                                   dst->ip_src->addr, dst->ip_dst->addr, 0, 0, ttl,
+                                   SPORT + flow, TCP_DPORT, id);
+            fn = &match_tcp6;
+        }
+    }
+
+    if (p == NULL) return NULL;
+    struct probe *probe = sched_send(s, t, dst->if_index, p->buf, p->length, fn);
+    packet_destroy(p);
+    return probe;
+}
+
+// Returns the stop reason when an answered probe ends the trace, or NULL
+static const char *traceroute_stop(const struct dst *dst,
+                                   const struct probe *probe) {
+    if (probe->response_len == 0) return NULL;
+
+    const char *stop = NULL;
+    if (dst->ip_dst->type == ADDR_IPV4) {
+        char *raddr = get_ip4_src_addr(probe->response);
+        char *dst_addr = get_ip4_dst_addr(probe->probe);
+        if (strcmp(raddr, dst_addr) == 0) {
+            stop = "completed";
+        } else if (get_icmp4_type(probe->response) == ICMPV4_TYPE_UNREACH) {
+            stop = "unreachable";
+        }
+        free(raddr);
+        free(dst_addr);
+    } else if (dst->ip_dst->type == ADDR_IPV6) {
+        char *raddr = get_ip6_src_addr(probe->response);
+        char *dst_addr = get_ip6_dst_addr(probe->probe);
+        if (strcmp(raddr, dst_addr) == 0) {
+            stop = "completed";
+        } else if (get_icmp6_type(probe->response) == ICMPV6_TYPE_UNREACH) {
+            stop = "unreachable";
+        }
+        free(raddr);
+        free(dst_addr);
+    }
+    return stop;
+}
+
+static char *traceroute_hop_addr(const struct dst *dst,
+                                 const struct probe *probe) {
+    if (probe->response_len == 0) return NULL;
+    if (dst->ip_dst->type == ADDR_IPV4) return get_ip4_src_addr(probe->response);
+    return get_ip6_src_addr(probe->response);
+}
+
+/* Hop distance from the ttl left in a reply, guessing the sender started
+ * from the nearest of the usual initial ttls (32, 64, 128 and 255) above
+ * it. Replies that cross asymmetric paths are off by a few hops. Too low
+ * only moves where forward and backward probing meet, too high has the
+ * destination answer the backward probes as well, see trace_backward.
+ */
+static int traceroute_distance(const struct dst *dst,
+                               const struct probe *probe) {
+    int ttl = 0;
+    if (dst->ip_dst->type == ADDR_IPV4) {
+        ttl = get_ip4_ttl(probe->response);
+    } else {
+        ttl = get_ip6_ttl(probe->response);
+    }
+
+    int initial = 32;
+    while (initial < ttl) initial *= 2;
+    if (initial > 255) initial = 255;
+    return initial - ttl + 1;
+}
+
+static void traceroute_print(const struct dst *dst, const struct probe *probe) {
+    if (dst->ip_dst->type == ADDR_IPV4) {
+        traceroute4_print(probe);
+    } else if (dst->ip_dst->type == ADDR_IPV6) {
+        traceroute6_print(probe);
+    }
+}
+
+/* The state of one traceroute. Up to at_once hops, flows probes each, are
+ * in flight, the forward probing from start_ttl up and the Doubletree
+ * backward probing from start_ttl - 1 down taking turns. Probes come back
+ * in any order and are kept by ttl and flow, each direction only moves
+ * over the hops it has in a row, so the stop rules see the hops in ttl
+ * order. Once a direction stops, the probes it still gets back are dropped.
+ */
+struct trace {
+    struct dst *dst;
+    int own_dst;
+    int probe_type;
+    int max_ttl;
+    int flows;
+    int at_once;
+    int gap_limit;
+    int start_ttl;
+    int estimate;        // 1 before the distance probe is sent, 2 after
+    struct probe *estimate_probe;
+    struct stop_set *stop_set;
+    char *prefix;
+
+    // Slots are ttl * flows + flow, (max_ttl + 2) * flows of them
+    struct probe **sent;
+    struct probe **hops; // handed back
+    int progressive;     // forward hops are printed as they are reached
+    int next_fwd;        // next slot to send forward
+    int next_bwd;        // next slot to send backward
+    int fwd;             // lowest forward ttl not reached
+    int bwd;             // highest backward ttl not reached
+    int fwd_done;
+    int bwd_done;
+    int turn;
+    int gap;
+    int probes;          // sent, for the summary
+    const char *stop;
+};
 
-            packet_destroy(p);
+static struct probe *trace_hop(const struct trace *tr, int ttl, int flow) {
+    return tr->hops[ttl * tr->flows + flow];
+}
+
+// A hop is reached once the probes of all its flows are handed back
+static int trace_reached(const struct trace *tr, int ttl) {
+    int flow = 0;
+    for (flow = 0; flow < tr->flows; flow++) {
+        if (trace_hop(tr, ttl, flow) == NULL) return 0;
+    }
+    return 1;
+}
+
+static void trace_drop(struct trace *tr, int from_ttl, int to_ttl) {
+    int slot = 0;
+    for (slot = from_ttl * tr->flows; slot < (to_ttl + 1) * tr->flows; slot++) {
+        if (tr->hops[slot] == NULL) continue;
+        probe_destroy(tr->hops[slot]);
+        tr->hops[slot] = NULL;
+    }
+}
+
+// Prints the distinct interfaces of a hop and returns how many there are
+static int trace_print_hop(const struct trace *tr, int ttl, int print) {
+    if (tr->flows == 1) {
+        const struct probe *probe = trace_hop(tr, ttl, 0);
+        if (probe == NULL) return 0;
+        if (print) traceroute_print(tr->dst, probe);
+        return (probe->response_len > 0) ? 1 : 0;
+    }
+
+    char **addrs = calloc(tr->flows, sizeof(*addrs));
+    if (addrs == NULL) return 0;
+
+    int count = 0;
+    int flow = 0;
+    for (flow = 0; flow < tr->flows; flow++) {
+        const struct probe *probe = trace_hop(tr, ttl, flow);
+        if (probe == NULL) continue;
+        char *addr = traceroute_hop_addr(tr->dst, probe);
+        if (addr == NULL) continue;
+
+        int k = 0;
+        while (k < count && strcmp(addrs[k], addr) != 0) k++;
+        if (k < count) {
+            free(addr);
+            continue;
+        }
+        addrs[count++] = addr;
+
+        if (print) {
+            char *time = timespec_diff_to_str(&probe->response_time,
+                                              &probe->sent_time);
+            if (count == 1) printf("%2d ", ttl);
+            printf(" %s (%s ms)", addr, time);
+            free(time);
+        }
+    }
+
+    if (print) {
+        if (count == 0) printf("%2d  *", ttl);
+        printf("\n");
+    }
+
+    int k = 0;
+    for (k = 0; k < count; k++) free(addrs[k]);
+    free(addrs);
+    return count;
+}
+
+// Returns the stop reason when the flows of a reached hop end the trace
+static const char *trace_stop(struct trace *tr, int ttl) {
+    const char *reason = NULL;
+    int answered = 0;
+    int flow = 0;
+    for (flow = 0; flow < tr->flows && reason == NULL; flow++) {
+        const struct probe *probe = trace_hop(tr, ttl, flow);
+        if (probe->response_len > 0) answered = 1;
+        reason = traceroute_stop(tr->dst, probe);
+    }
+
+    // Doubletree forward probing ends on a known pair
+    for (flow = 0; flow < tr->flows && reason == NULL; flow++) {
+        char *addr = traceroute_hop_addr(tr->dst, trace_hop(tr, ttl, flow));
+        if (addr != NULL && tr->prefix != NULL &&
+            stop_set_has_global(tr->stop_set, addr, tr->prefix)) {
+            reason = "stop-set";
         }
+        free(addr);
+    }
+
+    // Stop after gap_limit consecutive hops with no answer from any flow
+    tr->gap = (answered) ? 0 : tr->gap + 1;
+    if (reason == NULL && tr->gap_limit > 0 && tr->gap >= tr->gap_limit) {
+        reason = "gap-limit";
+    }
 
-        mt_wait(a, dst->if_index);
-
-        struct interface *i = mt_get_interface(a, dst->if_index);
-        int finished = 0;
-        struct list *it = i->probes;
-        while (i->probes->count > 0) {
-            struct probe *probe = (struct probe *)list_pop(i->probes);
-
-            if (finished == 0) {
-                if (dst->ip_dst->type == ADDR_IPV4) {
-                    traceroute4_print(probe);
-
-                    if (probe->response_len > 0) {
-                        char *raddr = get_ip4_src_addr(probe->response);
-                        char *dst_addr = get_ip4_dst_addr(probe->probe);
-                        if (get_icmp4_type(probe->response) == ICMPV4_TYPE_UNREACH ||
-                            strcmp(raddr, dst_addr) == 0) {
-                            finished = 1;
-                        }
-                        free(raddr);
-                        free(dst_addr);
-                    }
-                } else if (dst->ip_dst->type == ADDR_IPV6) {
-                    traceroute6_print(probe);
-
-                    if (probe->response_len > 0) {
-                        char *raddr = get_ip6_src_addr(probe->response);
-                        char *dst_addr = get_ip6_dst_addr(probe->probe);
-                        if (get_icmp6_type(probe->response) == ICMPV6_TYPE_UNREACH ||
-                            strcmp(raddr, dst_addr) == 0) {
-                            finished = 1;
-                        }
-                        free(raddr);
-                        free(dst_addr);
-                    }
-                }
+    if (reason == NULL && ttl == tr->max_ttl) reason = "max-ttl";
+    return reason;
+}
+
+static void trace_forward(struct trace *tr) {
+    while (tr->fwd_done == 0 && trace_reached(tr, tr->fwd)) {
+        if (tr->progressive) trace_print_hop(tr, tr->fwd, 1);
+
+        const char *reason = trace_stop(tr, tr->fwd);
+        if (reason != NULL) {
+            tr->stop = reason;
+            tr->fwd_done = 1;
+            trace_drop(tr, tr->fwd + 1, tr->max_ttl);
+        }
+        tr->fwd++;
+    }
+}
+
+// Whether any flow of a reached hop is answered by the destination itself
+static int trace_completed(const struct trace *tr, int ttl) {
+    int flow = 0;
+    for (flow = 0; flow < tr->flows; flow++) {
+        const char *stop = traceroute_stop(tr->dst, trace_hop(tr, ttl, flow));
+        if (stop != NULL && strcmp(stop, "completed") == 0) return 1;
+    }
+    return 0;
+}
+
+static void trace_backward(struct trace *tr) {
+    while (tr->bwd_done == 0 && trace_reached(tr, tr->bwd)) {
+        // Started past the destination, the path ends where it first answers
+        if (trace_completed(tr, tr->bwd)) {
+            tr->stop = "completed";
+            tr->fwd_done = 1;
+            trace_drop(tr, tr->bwd + 1, tr->max_ttl);
+        }
+
+        int flow = 0;
+        for (flow = 0; flow < tr->flows && tr->bwd_done == 0; flow++) {
+            char *addr = traceroute_hop_addr(tr->dst, trace_hop(tr, tr->bwd, flow));
+            if (addr != NULL && tr->stop_set != NULL &&
+                stop_set_has_local(tr->stop_set, addr)) {
+                tr->bwd_done = 1;
+                trace_drop(tr, 1, tr->bwd - 1);
             }
+            free(addr);
+        }
+        tr->bwd--;
+        if (tr->bwd < 1) tr->bwd_done = 1;
+    }
+}
+
+// Sets the ttl the forward probing starts at, the backward below it
+static void trace_start(struct trace *tr, int start_ttl) {
+    if (start_ttl < 1) start_ttl = 1;
+    if (start_ttl > tr->max_ttl) start_ttl = tr->max_ttl;
+    tr->start_ttl = start_ttl;
+    tr->next_fwd = start_ttl * tr->flows;
+    tr->next_bwd = start_ttl * tr->flows - 1;
+    tr->fwd = start_ttl;
+    tr->bwd = start_ttl - 1;
+    tr->bwd_done = (start_ttl == 1);
+}
+
+static int trace_send(struct sched *s, struct task *t, struct timespec *wake) {
+    struct trace *tr = (struct trace *)t->data;
+    if (sched_interrupted() || t->probes >= tr->at_once * tr->flows) return 0;
+
+    // Hops can only be printed as they come when nothing else is printing
+    if (tr->probes == 0) {
+        tr->progressive = (s->window == 1 && tr->start_ttl == 1 &&
+                           tr->estimate == 0);
+    }
+
+    // A single probe that reaches the destination tells where to start
+    if (tr->estimate != 0) {
+        if (tr->estimate == 2) return 0;
+        tr->estimate_probe = traceroute_send(s, t, tr->dst, tr->probe_type,
+                                             tr->max_ttl, 0,
+                                             TRACEROUTE_ID(0, 0));
+        if (tr->estimate_probe == NULL) return 0;
+        tr->estimate = 2;
+        tr->probes++;
+        return 1;
+    }
+
+    int fwd = (tr->fwd_done == 0 && tr->next_fwd / tr->flows <= tr->max_ttl);
+    int bwd = (tr->bwd_done == 0 && tr->next_bwd / tr->flows >= 1);
+    if (fwd && bwd) {
+        fwd = tr->turn;
+        tr->turn = !tr->turn;
+    }
+
+    int slot = 0;
+    if (fwd) {
+        slot = tr->next_fwd++;
+    } else if (bwd) {
+        slot = tr->next_bwd--;
+    } else {
+        return 0;
+    }
+
+    int ttl = slot / tr->flows;
+    int flow = slot % tr->flows;
+    struct probe *p = traceroute_send(s, t, tr->dst, tr->probe_type, ttl, flow,
+                                      TRACEROUTE_ID(ttl, flow));
+    if (p == NULL) return 0;
+    tr->sent[slot] = p;
+    tr->probes++;
+    return 1;
+}
+
+static void trace_receive(struct sched *s, struct task *t, struct probe *p) {
+    struct trace *tr = (struct trace *)t->data;
+
+    // Without a reply the trace starts at ttl 1
+    if (p == tr->estimate_probe) {
+        if (p->response_len > 0) trace_start(tr, traceroute_distance(tr->dst, p));
+        tr->estimate_probe = NULL;
+        tr->estimate = 0;
+        probe_destroy(p);
+        return;
+    }
+    int slots = (tr->max_ttl + 2) * tr->flows;
+    int slot = 0;
+    while (slot < slots && tr->sent[slot] != p) slot++;
+    if (slot == slots) {
+        probe_destroy(p);
+        return;
+    }
+    tr->sent[slot] = NULL;
 
-            probe_destroy(probe);
-            
+    int forward = (slot / tr->flows >= tr->start_ttl);
+    if ((forward && tr->fwd_done) || (!forward && tr->bwd_done)) {
+        probe_destroy(p);
+        return;
+    }
+
+    tr->hops[slot] = p;
+    if (forward) {
+        trace_forward(tr);
+    } else {
+        trace_backward(tr);
+    }
+}
+
+static int trace_finished(struct sched *s, struct task *t) {
+    struct trace *tr = (struct trace *)t->data;
+    if (sched_interrupted()) return 1;
+    return tr->estimate == 0 && tr->fwd_done && tr->bwd_done;
+}
+
+static void trace_free(struct trace *tr) {
+    if (tr->own_dst) dst_destroy(tr->dst);
+    free(tr->prefix);
+    free(tr->sent);
+    free(tr->hops);
+    free(tr);
+}
+
+// Prints the trace, in ttl order, and adds its hops to the stop sets
+static void trace_destroy(struct task *t) {
+    struct trace *tr = (struct trace *)t->data;
+    if (tr->stop == NULL) tr->stop = "interrupted";
+
+    int hops = 0;
+    int balanced = 0;
+    int ttl = 0;
+    for (ttl = 1; ttl <= tr->max_ttl; ttl++) {
+        int flow = 0;
+        while (flow < tr->flows && trace_hop(tr, ttl, flow) == NULL) flow++;
+        if (flow == tr->flows) continue;
+        hops++;
+        int print = (!tr->progressive || ttl < tr->start_ttl || ttl >= tr->fwd);
+        if (trace_print_hop(tr, ttl, print) > 1) balanced++;
+    }
+    traceroute_print_summary(tr->dst, tr->stop, hops, tr->probes, tr->flows,
+                             balanced);
+    fflush(stdout);
+
+    int slot = 0;
+    for (slot = 0; slot < (tr->max_ttl + 2) * tr->flows; slot++) {
+        struct probe *probe = tr->hops[slot];
+        if (probe == NULL) continue;
+        char *addr = traceroute_hop_addr(tr->dst, probe);
+        if (addr != NULL && tr->prefix != NULL) {
+            stop_set_add_local(tr->stop_set, addr);
+            stop_set_add_global(tr->stop_set, addr, tr->prefix);
         }
-        if (finished) break;
+        free(addr);
+        probe_destroy(probe);
     }
+    trace_free(tr);
 }
 
-int mt_traceroute(struct mt *a, const struct dst *dst, int probe_type,
-                  int max_ttl, int at_once) {
+struct task *traceroute_task_create(struct dst *dst, int own_dst,
+                                    int probe_type, int max_ttl, int flows,
+                                    int at_once, int gap_limit, int start_ttl,
+                                    struct stop_set *stop_set) {
     if (dst->ip_dst->type != ADDR_IPV4 &&
-        dst->ip_dst->type != ADDR_IPV6) return -1;
+        dst->ip_dst->type != ADDR_IPV6) return NULL;
+    if (max_ttl < 1 || max_ttl > 255) return NULL;
+    if (flows < 1 || flows > 255) return NULL;
+
+    struct trace *tr = malloc(sizeof(*tr));
+    if (tr == NULL) return NULL;
+    memset(tr, 0, sizeof(*tr));
 
-    return traceroute(a, dst, probe_type, max_ttl, at_once);
+    // Zero sends the whole path at once, paced only by the send wait
+    if (at_once <= 0) at_once = max_ttl;
+
+    tr->dst = dst;
+    tr->probe_type = probe_type;
+    tr->max_ttl = max_ttl;
+    tr->flows = flows;
+    tr->at_once = at_once;
+    tr->gap_limit = gap_limit;
+    tr->stop_set = stop_set;
+    tr->prefix = (stop_set != NULL) ? stop_set_prefix(dst->ip_dst) : NULL;
+    tr->sent = calloc((max_ttl + 2) * flows, sizeof(*tr->sent));
+    tr->hops = calloc((max_ttl + 2) * flows, sizeof(*tr->hops));
+
+    struct task *t = NULL;
+    if (tr->sent != NULL && tr->hops != NULL) {
+        // Zero starts at the estimated distance to the destination
+        tr->estimate = (start_ttl == 0);
+        trace_start(tr, start_ttl);
+        t = task_create(&trace_send, &trace_receive, &trace_finished,
+                        &trace_destroy, tr);
+    }
+    if (t == NULL) {
+        trace_free(tr);
+        return NULL;
+    }
+    tr->own_dst = own_dst;
+    t->if_index = dst->if_index;
+    return t;
+}
+
+int mt_traceroute(struct mt *a, const struct dst *dst, int probe_type,
+                  int max_ttl, int flows, int at_once, int gap_limit,
+                  int start_ttl, const char *stop_set_path) {
+    struct stop_set *stop_set = NULL;
+    char *src = NULL;
+    if (stop_set_path != NULL) {
+        stop_set = stop_set_create();
+        if (stop_set == NULL) return -1;
+        src = addr_to_str(dst->ip_src);
+        stop_set_load(stop_set, stop_set_path, src);
+    }
+
+    int r = -1;
+    struct sched *s = sched_create(a, 1);
+    if (s != NULL) {
+        struct task *t = traceroute_task_create((struct dst *)dst, 0,
+                                                probe_type, max_ttl, flows,
+                                                at_once, gap_limit, start_ttl,
+                                                stop_set);
+        if (t != NULL) {
+            sched_add(s, t);
+            r = 0;
+        }
+        sched_destroy(s);
+    }
+
+    if (stop_set != NULL) {
+        if (r == 0 && stop_set_save(stop_set, stop_set_path, src) == -1) {
+            printf("could not write the stop set file %s\n", stop_set_path);
+        }
+        free(src);
+        stop_set_destroy(stop_set);
+    }
+    return r;
 }
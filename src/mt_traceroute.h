@@ -31,8 +31,18 @@
 
 #include "mt.h"
 #include "dst.h"
+#include "sched.h"
+#include "stop_set.h"
+
+// A traceroute to run on a scheduler, it destroys dst at the end if
+// own_dst is set and adds its hops to stop_set if there is one
+struct task *traceroute_task_create(struct dst *dst, int own_dst,
+                                    int probe_type, int max_ttl, int flows,
+                                    int at_once, int gap_limit, int start_ttl,
+                                    struct stop_set *stop_set);
 
 int mt_traceroute(struct mt *a, const struct dst *dst, int probe_type,
-                  int max_ttl, int at_once);
+                  int max_ttl, int flows, int at_once, int gap_limit,
+                  int start_ttl, const char *stop_set_path);
 
 #endif // __MT_TRACEROUTE_H__
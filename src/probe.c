@@ -28,6 +28,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "util.h"
 #include "probe.h"
 
 struct probe *probe_create(const uint8_t *probe, uint32_t probe_len, match_fn fn) {
@@ -56,10 +57,9 @@ void probe_destroy(struct probe *p) {
     free(p);
 }
 
-int probe_timeout(const struct probe *p, int timeout) {
-    struct timespec now;
-    clock_gettime(CLOCK_REALTIME, &now);
-    if ((now.tv_sec - p->sent_time.tv_sec) >= timeout) return 1;
+int probe_timeout(const struct probe *p) {
+    struct timespec elapsed = timespec_diff_now(&p->last_sent_time);
+    if (timespec_cmp(&elapsed, &p->timeout) != -1) return 1;
     return 0;
 }
 
@@ -37,20 +37,25 @@ typedef int (*match_fn)(const uint8_t *, uint32_t, const uint8_t *, uint32_t);
 struct probe {
     int if_index;
     int retries;
-    struct timespec sent_time;
+    int expired; // timed out after its last retry
+    int once;    // never sent again, its RTT is what is measured
+    struct timespec sent_time; // of the first copy, RTTs are measured from it
+    struct timespec last_sent_time; // of the last copy, timeouts run from it
     struct timespec response_time;
+    struct timespec timeout; // after last_sent_time, set when it is sent
     uint8_t *probe;
     uint32_t probe_len;
     uint8_t *response;
     uint32_t response_len;
     match_fn fn;
+    void *data; // set by the caller, e.g. the target the probe belongs to
 };
 
 struct probe *probe_create(const uint8_t *probe, uint32_t probe_len, match_fn fn);
 
 void probe_destroy(struct probe *p);
 
-int probe_timeout(const struct probe *p, int timeout);
+int probe_timeout(const struct probe *p);
 
 int probe_match(struct probe *p, const uint8_t *buf, uint32_t len,
                 const struct timespec *ts);
@@ -0,0 +1,204 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <netinet/in.h>
+
+#include "raw_recv.h"
+#include "pdu_eth.h"
+#include "pdu_ipv6.h"
+
+static int raw_recv_socket(int family, int protocol, const char *if_name) {
+    int fd = socket(family, SOCK_RAW | SOCK_NONBLOCK, protocol);
+    if (fd == -1) return -1;
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    if (family == AF_INET6) {
+        // The IPv6 header is not delivered, the fields replies are matched
+        // on come as ancillary data
+        setsockopt(fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &on, sizeof(on));
+        setsockopt(fd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on));
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, if_name,
+                   strlen(if_name)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+struct raw_recv *raw_recv_open(int if_index) {
+    char if_name[IF_NAMESIZE];
+    if (if_indextoname(if_index, if_name) == NULL) return NULL;
+
+    struct raw_recv *r = malloc(sizeof(*r));
+    if (r == NULL) return NULL;
+    memset(r, 0, sizeof(*r));
+
+    int families[RAW_RECV_FDS] = { AF_INET, AF_INET6, AF_INET, AF_INET6 };
+    int protocols[RAW_RECV_FDS] = { IPPROTO_ICMP, IPPROTO_ICMPV6,
+                                    IPPROTO_TCP, IPPROTO_TCP };
+    int k = 0;
+    for (k = 0; k < RAW_RECV_FDS; k++) {
+        int fd = raw_recv_socket(families[k], protocols[k], if_name);
+        if (fd == -1) continue;
+        r->fds[r->count] = fd;
+        r->families[r->count] = families[k];
+        r->protocols[r->count] = protocols[k];
+        r->count++;
+    }
+
+    if (r->count == 0) {
+        free(r);
+        return NULL;
+    }
+
+    for (k = 0; k < RAW_RECV_BATCH; k++) {
+        r->iovs[k].iov_base = r->bufs[k];
+        r->iovs[k].iov_len = RAW_RECV_BUF;
+    }
+    return r;
+}
+
+void raw_recv_close(struct raw_recv *r) {
+    if (r == NULL) return;
+    int k = 0;
+    for (k = 0; k < r->count; k++) close(r->fds[k]);
+    free(r);
+}
+
+static void raw_recv_ts(struct msghdr *h, struct timespec *ts) {
+    struct cmsghdr *c = NULL;
+    for (c = CMSG_FIRSTHDR(h); c != NULL; c = CMSG_NXTHDR(h, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+            memcpy(ts, CMSG_DATA(c), sizeof(*ts));
+            return;
+        }
+    }
+    clock_gettime(CLOCK_REALTIME, ts);
+}
+
+/* Frames a received packet as the captures are: an Ethernet header and,
+ * for IPv6, the IP header rebuilt from the source address, the
+ * destination in IPV6_PKTINFO and the hop limit
+ */
+static uint32_t raw_recv_frame(struct raw_recv *r, int family, int protocol,
+                               struct msghdr *h, const uint8_t *buf,
+                               uint32_t len) {
+    struct eth_hdr *eth = (struct eth_hdr *)r->frame;
+    memset(eth, 0, sizeof(*eth));
+
+    if (family == AF_INET) {
+        eth->type = htons(ETH_TYPE_IPV4);
+        memcpy(r->frame + ETH_H_SIZE, buf, len);
+        return ETH_H_SIZE + len;
+    }
+
+    eth->type = htons(ETH_TYPE_IPV6);
+    struct ipv6_hdr *ip = (struct ipv6_hdr *)(r->frame + ETH_H_SIZE);
+    memset(ip, 0, sizeof(*ip));
+    ip->version_tc_fl = htonl(6 << 28);
+    ip->length = htons(len);
+    ip->next_header = protocol;
+
+    struct sockaddr_in6 *src = (struct sockaddr_in6 *)h->msg_name;
+    memcpy(ip->src_addr, &src->sin6_addr, sizeof(ip->src_addr));
+
+    struct cmsghdr *c = NULL;
+    for (c = CMSG_FIRSTHDR(h); c != NULL; c = CMSG_NXTHDR(h, c)) {
+        if (c->cmsg_level != IPPROTO_IPV6) continue;
+        if (c->cmsg_type == IPV6_PKTINFO) {
+            struct in6_pktinfo *info = (struct in6_pktinfo *)CMSG_DATA(c);
+            memcpy(ip->dst_addr, &info->ipi6_addr, sizeof(ip->dst_addr));
+        } else if (c->cmsg_type == IPV6_HOPLIMIT) {
+            int hop_limit = 0;
+            memcpy(&hop_limit, CMSG_DATA(c), sizeof(hop_limit));
+            ip->hop_limit = hop_limit;
+        }
+    }
+
+    memcpy(r->frame + ETH_H_SIZE + IPV6_H_SIZE, buf, len);
+    return ETH_H_SIZE + IPV6_H_SIZE + len;
+}
+
+static int raw_recv_batch(struct raw_recv *r, int k, raw_recv_fn fn,
+                          void *ctx) {
+    int m = 0;
+    for (m = 0; m < RAW_RECV_BATCH; m++) {
+        struct msghdr *h = &r->msgs[m].msg_hdr;
+        memset(h, 0, sizeof(*h));
+        h->msg_name = &r->names[m];
+        h->msg_namelen = sizeof(r->names[m]);
+        h->msg_iov = &r->iovs[m];
+        h->msg_iovlen = 1;
+        h->msg_control = r->ctrls[m];
+        h->msg_controllen = RAW_RECV_CTRL;
+    }
+
+    int n = recvmmsg(r->fds[k], r->msgs, RAW_RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (n <= 0) return 0;
+
+    for (m = 0; m < n; m++) {
+        struct msghdr *h = &r->msgs[m].msg_hdr;
+        struct timespec ts;
+        raw_recv_ts(h, &ts);
+        uint32_t len = raw_recv_frame(r, r->families[k], r->protocols[k], h,
+                                      r->bufs[m], r->msgs[m].msg_len);
+        fn(r->frame, len, &ts, ctx);
+    }
+    return n;
+}
+
+// Hands every packet queued to fn, waiting up to timeout_ms for the first
+int raw_recv_dispatch(struct raw_recv *r, int timeout_ms, raw_recv_fn fn,
+                      void *ctx) {
+    struct pollfd fds[RAW_RECV_FDS];
+    int k = 0;
+    for (k = 0; k < r->count; k++) {
+        fds[k].fd = r->fds[k];
+        fds[k].events = POLLIN;
+        fds[k].revents = 0;
+    }
+    if (poll(fds, r->count, timeout_ms) <= 0) return 0;
+
+    int count = 0;
+    for (k = 0; k < r->count; k++) {
+        if ((fds[k].revents & POLLIN) == 0) continue;
+        int n = 0;
+        while ((n = raw_recv_batch(r, k, fn, ctx)) > 0) {
+            count += n;
+            if (n < RAW_RECV_BATCH) break;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,73 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RAW_RECV_H__
+#define __RAW_RECV_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define RAW_RECV_BATCH 32
+#define RAW_RECV_BUF   1518
+#define RAW_RECV_CTRL  128
+
+// ICMP, ICMPv6, TCP and TCP over IPv6
+#define RAW_RECV_FDS   4
+
+typedef void (*raw_recv_fn)(const uint8_t *buf, uint32_t len,
+                            const struct timespec *ts, void *ctx);
+
+/* Receives replies on raw ICMP and TCP sockets bound to an interface,
+ * instead of capturing every frame that reaches it. The kernel filters by
+ * protocol and timestamps each packet on arrival, and queued packets are
+ * read in batches with recvmmsg.
+ */
+struct raw_recv {
+    int fds[RAW_RECV_FDS];
+    int families[RAW_RECV_FDS];
+    int protocols[RAW_RECV_FDS];
+    int count;
+
+    struct mmsghdr msgs[RAW_RECV_BATCH];
+    struct iovec iovs[RAW_RECV_BATCH];
+    struct sockaddr_storage names[RAW_RECV_BATCH];
+    uint8_t bufs[RAW_RECV_BATCH][RAW_RECV_BUF];
+    uint8_t ctrls[RAW_RECV_BATCH][RAW_RECV_CTRL];
+    uint8_t frame[RAW_RECV_BUF + 64]; // room for the headers put back
+};
+
+struct raw_recv *raw_recv_open(int if_index);
+
+void raw_recv_close(struct raw_recv *r);
+
+int raw_recv_dispatch(struct raw_recv *r, int timeout_ms, raw_recv_fn fn,
+                      void *ctx);
+
+#endif // __RAW_RECV_H__
@@ -39,8 +39,11 @@
 
 #define MSGBUF 1024
 
+// Receive buffer of the FIB dump, the kernel fills it with many routes
+#define DUMPBUF 32768
+
 static int route_lookup(const struct addr *dst, int *if_index,
-                        struct addr **gateway) {
+                        struct addr **gateway, struct addr **prefsrc) {
     int len = (dst->type == ADDR_IPV4) ? 4 : 16;
     uint32_t pid = getpid();
 
@@ -90,6 +93,8 @@ static int route_lookup(const struct addr *dst, int *if_index,
             *if_index = *((int *)RTA_DATA(rta));
         } else if (rta->rta_type == RTA_GATEWAY) {
             *gateway = addr_create(dst->type, RTA_DATA(rta));
+        } else if (rta->rta_type == RTA_PREFSRC) {
+            *prefsrc = addr_create(dst->type, RTA_DATA(rta));
         }
     }
 
@@ -106,7 +111,8 @@ struct route *route_create(const struct addr *dst) {
     if (r == NULL) return NULL;
     memset(r, 0, sizeof(*r));
 
-    if (route_lookup(dst, &r->if_index, &r->gateway) == -1) {
+    if (route_lookup(dst, &r->if_index, &r->gateway, &r->prefsrc) == -1) {
+        if (r->gateway != NULL) addr_destroy(r->gateway);
         free(r);
         return NULL;
     }
@@ -115,7 +121,228 @@ struct route *route_create(const struct addr *dst) {
 }
 
 void route_destroy(struct route *r) {
-    addr_destroy(r->gateway);
+    if (r->gateway != NULL) addr_destroy(r->gateway);
+    if (r->prefsrc != NULL) addr_destroy(r->prefsrc);
     addr_destroy(r->dst);
     free(r);
 }
+
+/* Binary trie over the address bits, one per family. Nodes on the path to
+ * a prefix have no route; lookups keep the last route seen on the way
+ * down, which is the longest matching prefix.
+ */
+struct route_node {
+    struct route_node *child[2];
+    struct route *route;
+    uint32_t metric;
+};
+
+struct route_table {
+    struct route_node *root4;
+    struct route_node *root6;
+};
+
+static int addr_bit(const uint8_t *addr, int bit) {
+    return (addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+static void route_node_destroy(struct route_node *n) {
+    if (n == NULL) return;
+    route_node_destroy(n->child[0]);
+    route_node_destroy(n->child[1]);
+    if (n->route != NULL) route_destroy(n->route);
+    free(n);
+}
+
+static struct route_node *route_node_create(void) {
+    struct route_node *n = malloc(sizeof(*n));
+    if (n == NULL) return NULL;
+    memset(n, 0, sizeof(*n));
+    return n;
+}
+
+// Keeps the route of lowest metric when a prefix is in the FIB twice, a
+// route of the same metric replaces the one there
+static int route_table_insert(struct route_table *t, struct addr *prefix,
+                              int prefix_len, int if_index,
+                              struct addr *gateway, struct addr *prefsrc,
+                              uint32_t metric) {
+    struct route_node **root = (prefix->type == ADDR_IPV4) ? &t->root4
+                                                            : &t->root6;
+    if (*root == NULL) *root = route_node_create();
+    struct route_node *n = *root;
+
+    int bit = 0;
+    for (bit = 0; n != NULL && bit < prefix_len; bit++) {
+        int b = addr_bit(prefix->addr, bit);
+        if (n->child[b] == NULL) n->child[b] = route_node_create();
+        n = n->child[b];
+    }
+    if (n == NULL) return -1;
+    if (n->route != NULL && n->metric < metric) return 0;
+
+    struct route *r = malloc(sizeof(*r));
+    if (r == NULL) return -1;
+    r->dst = addr_copy(prefix);
+    r->gateway = (gateway != NULL) ? addr_copy(gateway) : NULL;
+    r->prefsrc = (prefsrc != NULL) ? addr_copy(prefsrc) : NULL;
+    r->if_index = if_index;
+
+    if (n->route != NULL) route_destroy(n->route);
+    n->route = r;
+    n->metric = metric;
+    return 0;
+}
+
+/* Adds a RTM_NEWROUTE of the main table to the trie. Unreachable,
+ * prohibit and blackhole routes go in without an interface, so what they
+ * cover does not match a broader route the kernel would not use.
+ */
+void route_table_add(struct route_table *t, struct nlmsghdr *msg) {
+    struct rtmsg *rtmsg = NLMSG_DATA(msg);
+    int reject = (rtmsg->rtm_type == RTN_UNREACHABLE ||
+                  rtmsg->rtm_type == RTN_PROHIBIT ||
+                  rtmsg->rtm_type == RTN_BLACKHOLE);
+    if (rtmsg->rtm_type != RTN_UNICAST && !reject) return;
+    if (rtmsg->rtm_flags & RTM_F_CLONED) return;
+    if (rtmsg->rtm_family != AF_INET && rtmsg->rtm_family != AF_INET6) return;
+
+    int type = (rtmsg->rtm_family == AF_INET) ? ADDR_IPV4 : ADDR_IPV6;
+    uint8_t dst[16];
+    memset(dst, 0, sizeof(dst));
+    struct addr *gateway = NULL;
+    struct addr *prefsrc = NULL;
+    uint32_t table = rtmsg->rtm_table;
+    uint32_t metric = 0;
+    int if_index = 0;
+
+    int len = msg->nlmsg_len - NLMSG_LENGTH(sizeof(*rtmsg));
+    struct rtattr *rta = NULL;
+    for (rta = RTM_RTA(rtmsg); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == RTA_DST) {
+            memcpy(dst, RTA_DATA(rta), (type == ADDR_IPV4) ? 4 : 16);
+        } else if (rta->rta_type == RTA_OIF) {
+            if_index = *((int *)RTA_DATA(rta));
+        } else if (rta->rta_type == RTA_GATEWAY && gateway == NULL) {
+            gateway = addr_create(type, RTA_DATA(rta));
+        } else if (rta->rta_type == RTA_PREFSRC && prefsrc == NULL) {
+            prefsrc = addr_create(type, RTA_DATA(rta));
+        } else if (rta->rta_type == RTA_PRIORITY) {
+            metric = *((uint32_t *)RTA_DATA(rta));
+        } else if (rta->rta_type == RTA_TABLE) {
+            table = *((uint32_t *)RTA_DATA(rta));
+        } else if (rta->rta_type == RTA_MULTIPATH && if_index == 0) {
+            // Multipath routes are resolved through their first next hop
+            struct rtnexthop *nh = (struct rtnexthop *)RTA_DATA(rta);
+            if (RTA_PAYLOAD(rta) < sizeof(*nh)) continue;
+            if_index = nh->rtnh_ifindex;
+            int nh_len = nh->rtnh_len - sizeof(*nh);
+            struct rtattr *nh_rta = RTNH_DATA(nh);
+            for (; RTA_OK(nh_rta, nh_len); nh_rta = RTA_NEXT(nh_rta, nh_len)) {
+                if (nh_rta->rta_type == RTA_GATEWAY && gateway == NULL) {
+                    gateway = addr_create(type, RTA_DATA(nh_rta));
+                }
+            }
+        }
+    }
+
+    if (reject) {
+        if (gateway != NULL) addr_destroy(gateway);
+        gateway = NULL;
+        if_index = 0;
+    }
+
+    if (table == RT_TABLE_MAIN && (if_index > 0 || reject)) {
+        struct addr *prefix = addr_create(type, dst);
+        if (prefix != NULL) {
+            route_table_insert(t, prefix, rtmsg->rtm_dst_len, if_index,
+                               gateway, prefsrc, metric);
+            addr_destroy(prefix);
+        }
+    }
+    if (gateway != NULL) addr_destroy(gateway);
+    if (prefsrc != NULL) addr_destroy(prefsrc);
+}
+
+static int route_table_dump(struct route_table *t, int family) {
+    uint8_t msg_buf[MSGBUF];
+    memset(msg_buf, 0, MSGBUF);
+
+    struct nlmsghdr *msg = (struct nlmsghdr *)msg_buf;
+    msg->nlmsg_len   = NLMSG_LENGTH(sizeof(struct rtmsg));
+    msg->nlmsg_type  = RTM_GETROUTE;
+    msg->nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    msg->nlmsg_seq   = 1;
+    msg->nlmsg_pid   = getpid();
+
+    struct rtmsg *rmsg = NLMSG_DATA(msg);
+    rmsg->rtm_family = family;
+
+    int fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
+    if (fd == -1) return -1;
+    if (send(fd, msg_buf, msg->nlmsg_len, 0) == -1) goto fail;
+
+    uint8_t *recv_buf = malloc(DUMPBUF);
+    if (recv_buf == NULL) goto fail;
+
+    int done = 0;
+    while (done == 0) {
+        int len = recv(fd, recv_buf, DUMPBUF, 0);
+        if (len <= 0) break;
+
+        struct nlmsghdr *resp = (struct nlmsghdr *)recv_buf;
+        for (; NLMSG_OK(resp, len); resp = NLMSG_NEXT(resp, len)) {
+            if (resp->nlmsg_type == NLMSG_DONE ||
+                resp->nlmsg_type == NLMSG_ERROR) {
+                done = (resp->nlmsg_type == NLMSG_DONE) ? 1 : -1;
+                break;
+            }
+            if (resp->nlmsg_type == RTM_NEWROUTE) route_table_add(t, resp);
+        }
+    }
+
+    free(recv_buf);
+    close(fd);
+    return (done == 1) ? 0 : -1;
+
+fail:
+    close(fd);
+    return -1;
+}
+
+// Dumps the main routing table of the kernel, once
+struct route_table *route_table_create(void) {
+    struct route_table *t = malloc(sizeof(*t));
+    if (t == NULL) return NULL;
+    memset(t, 0, sizeof(*t));
+
+    if (route_table_dump(t, AF_INET) == -1 ||
+        route_table_dump(t, AF_INET6) == -1) {
+        route_table_destroy(t);
+        return NULL;
+    }
+    return t;
+}
+
+void route_table_destroy(struct route_table *t) {
+    route_node_destroy(t->root4);
+    route_node_destroy(t->root6);
+    free(t);
+}
+
+// Longest prefix match, the route belongs to the table and has no
+// interface when the destination is not routed
+struct route *route_table_lookup(const struct route_table *t,
+                                 const struct addr *dst) {
+    struct route_node *n = (dst->type == ADDR_IPV4) ? t->root4 : t->root6;
+    int bits = (dst->type == ADDR_IPV4) ? 32 : 128;
+    struct route *r = NULL;
+
+    int bit = 0;
+    for (bit = 0; n != NULL; bit++) {
+        if (n->route != NULL) r = n->route;
+        if (bit == bits) break;
+        n = n->child[addr_bit(dst->addr, bit)];
+    }
+    return r;
+}
@@ -33,11 +33,22 @@
 
 struct route {
     struct addr *dst;
-    struct addr *gateway;
-    int if_index;
+    struct addr *gateway; // NULL when the destination is on-link
+    struct addr *prefsrc; // RTA_PREFSRC, NULL when the route has none
+    int if_index; // 0 for unreachable, prohibit and blackhole routes
 };
 
 struct route *route_create(const struct addr *dst);
 void route_destroy(struct route *r);
 
+// Longest prefix match over a single dump of the kernel FIB
+struct route_table;
+struct nlmsghdr;
+
+struct route_table *route_table_create(void);
+void route_table_destroy(struct route_table *t);
+void route_table_add(struct route_table *t, struct nlmsghdr *msg);
+struct route *route_table_lookup(const struct route_table *t,
+                                 const struct addr *dst);
+
 #endif // __ROUTE_H__
@@ -0,0 +1,195 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "pdu_eth.h"
+#include "pdu_ipv4.h"
+#include "pdu_ipv6.h"
+#include "addr.h"
+#include "util.h"
+#include "rto.h"
+
+#define RTO_KEY_LEN (ADDR_IPV6_SIZE + 1)
+#define RTO_CLOCK_US 1000 // clock granularity term of the RTO
+
+static void rto_free(void *data) {
+    free(data);
+}
+
+struct rto_table *rto_table_create(int min_ms, int max_ms) {
+    struct rto_table *t = malloc(sizeof(*t));
+    if (t == NULL) return NULL;
+    memset(t, 0, sizeof(*t));
+
+    t->rtos = lru_create(RTO_ENTRIES_MAX, &rto_free, NULL);
+    if (t->rtos == NULL) {
+        free(t);
+        return NULL;
+    }
+
+    if (min_ms > max_ms) min_ms = max_ms;
+    t->min = timespec_from_ms(min_ms);
+    t->max = timespec_from_ms(max_ms);
+    return t;
+}
+
+void rto_table_destroy(struct rto_table *t) {
+    lru_destroy(t->rtos);
+    free(t);
+}
+
+// The key of a probe is its destination followed by its ttl
+static int rto_key(const struct probe *p, uint8_t *key, uint8_t **ttl) {
+    const uint8_t *b = p->probe;
+    if (p->probe_len < ETH_H_SIZE) return -1;
+    uint16_t type = ntohs(((const struct eth_hdr *)b)->type);
+
+    if (type == ETH_TYPE_IPV4 && p->probe_len >= ETH_H_SIZE + IPV4_H_SIZE) {
+        const struct ipv4_hdr *ip = (const struct ipv4_hdr *)(b + ETH_H_SIZE);
+        memcpy(key, &ip->dst_addr, ADDR_IPV4_SIZE);
+        key[ADDR_IPV4_SIZE] = ip->ttl;
+        *ttl = &key[ADDR_IPV4_SIZE];
+        return ADDR_IPV4_SIZE + 1;
+    } else if (type == ETH_TYPE_IPV6 && p->probe_len >= ETH_H_SIZE + IPV6_H_SIZE) {
+        const struct ipv6_hdr *ip = (const struct ipv6_hdr *)(b + ETH_H_SIZE);
+        memcpy(key, ip->dst_addr, ADDR_IPV6_SIZE);
+        key[ADDR_IPV6_SIZE] = ip->hop_limit;
+        *ttl = &key[ADDR_IPV6_SIZE];
+        return ADDR_IPV6_SIZE + 1;
+    }
+    return -1;
+}
+
+static struct timespec rto_clamp(const struct rto_table *t,
+                                 struct timespec rto) {
+    if (timespec_cmp(&rto, &t->min) == -1) return t->min;
+    if (timespec_cmp(&rto, &t->max) == 1) return t->max;
+    return rto;
+}
+
+/* The timeout of the probe hop, or of the closest hop before it on the
+ * way to the same destination, as hops further away are usually slower
+ * to answer. A timeout the hop backed off to holds until it is sampled
+ * without ambiguity. Without any sample it is the configured maximum.
+ */
+struct timespec rto_timeout(struct rto_table *t, const struct probe *p) {
+    uint8_t key[RTO_KEY_LEN];
+    uint8_t *ttl = NULL;
+    int len = rto_key(p, key, &ttl);
+    if (len == -1) return t->max;
+
+    struct rto *r = lru_get(t->rtos, key, len);
+    if (r != NULL && r->backoff.tv_sec + r->backoff.tv_nsec > 0) {
+        return rto_clamp(t, r->backoff);
+    }
+    for (; *ttl > 0 && (r == NULL || !r->sampled); (*ttl)--) {
+        r = lru_get(t->rtos, key, len);
+    }
+    if (r == NULL || !r->sampled) return t->max;
+
+    uint32_t var = 4 * r->rttvar;
+    if (var < RTO_CLOCK_US) var = RTO_CLOCK_US;
+    uint64_t us = (uint64_t)r->srtt + var;
+
+    struct timespec rto;
+    rto.tv_sec = us / 1000000;
+    rto.tv_nsec = (us % 1000000) * 1000;
+    return rto_clamp(t, rto);
+}
+
+static struct rto *rto_entry(struct rto_table *t, const uint8_t *key,
+                             int len) {
+    struct rto *r = lru_get(t->rtos, key, len);
+    if (r != NULL) return r;
+
+    r = malloc(sizeof(*r));
+    if (r == NULL) return NULL;
+    memset(r, 0, sizeof(*r));
+    if (lru_put(t->rtos, key, len, r) == -1) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+// Keeps the doubled timeout of a probe for its hop and returns it
+static struct timespec rto_keep(struct rto_table *t, const struct probe *p) {
+    struct timespec d = timespec_add(&p->timeout, &p->timeout);
+    d = rto_clamp(t, d);
+
+    uint8_t key[RTO_KEY_LEN];
+    uint8_t *ttl = NULL;
+    int len = rto_key(p, key, &ttl);
+    struct rto *r = (len != -1) ? rto_entry(t, key, len) : NULL;
+    if (r == NULL) return d;
+    if (timespec_cmp(&d, &r->backoff) == 1) r->backoff = d;
+    return r->backoff;
+}
+
+// Doubles the timeout of a probe sent again, up to the maximum, the later
+// probes of the hop start from it
+void rto_backoff(struct rto_table *t, struct probe *p) {
+    p->timeout = rto_keep(t, p);
+}
+
+// Backs the hop off for a probe that timed out and is not sent again
+void rto_expire(struct rto_table *t, const struct probe *p) {
+    rto_keep(t, p);
+}
+
+void rto_update(struct rto_table *t, const struct probe *p) {
+    // Karn: the answer of a probe sent again may be to any of its copies
+    if (p->retries > 0 || p->response_len == 0) return;
+
+    uint8_t key[RTO_KEY_LEN];
+    uint8_t *ttl = NULL;
+    int len = rto_key(p, key, &ttl);
+    if (len == -1) return;
+
+    struct timespec d = timespec_diff(&p->response_time, &p->sent_time);
+    if (d.tv_sec < 0) return;
+    uint64_t us = (uint64_t)d.tv_sec * 1000000 + d.tv_nsec / 1000;
+    uint32_t rtt = (us > UINT32_MAX) ? UINT32_MAX : (uint32_t)us;
+
+    struct rto *r = rto_entry(t, key, len);
+    if (r == NULL) return;
+    memset(&r->backoff, 0, sizeof(r->backoff));
+    if (!r->sampled) {
+        r->srtt = rtt;
+        r->rttvar = rtt / 2;
+        r->sampled = 1;
+        return;
+    }
+
+    uint32_t err = (r->srtt > rtt) ? r->srtt - rtt : rtt - r->srtt;
+    r->rttvar = r->rttvar - r->rttvar / 4 + err / 4;
+    r->srtt = r->srtt - r->srtt / 8 + rtt / 8;
+}
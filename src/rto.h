@@ -0,0 +1,69 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RTO_H__
+#define __RTO_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "lru.h"
+#include "probe.h"
+
+#define RTO_MIN_MS 200
+#define RTO_ENTRIES_MAX 16384
+
+// Smoothed RTT and RTT variance, in microseconds (RFC 6298)
+struct rto {
+    uint32_t srtt;
+    uint32_t rttvar;
+    int sampled;             // srtt and rttvar are set
+    struct timespec backoff; // Karn, kept until a clean sample, 0 if none
+};
+
+// Retransmission timeouts per (destination, ttl) of the probes, the least
+// recently used go once RTO_ENTRIES_MAX are kept
+struct rto_table {
+    struct lru *rtos;
+    struct timespec min;
+    struct timespec max;
+};
+
+struct rto_table *rto_table_create(int min_ms, int max_ms);
+
+void rto_table_destroy(struct rto_table *t);
+
+struct timespec rto_timeout(struct rto_table *t, const struct probe *p);
+
+void rto_backoff(struct rto_table *t, struct probe *p);
+
+void rto_expire(struct rto_table *t, const struct probe *p);
+
+void rto_update(struct rto_table *t, const struct probe *p);
+
+#endif // __RTO_H__
@@ -0,0 +1,240 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "sched.h"
+
+static volatile sig_atomic_t sched_stop = 0;
+static struct sigaction sched_old_sigint;
+static int sched_count = 0;
+
+static void sched_sigint(int sig) {
+    sched_stop = 1;
+}
+
+// Tasks see SIGINT through sched_interrupted and end their measurements
+// cleanly, so their results are still reported
+int sched_interrupted(void) {
+    return sched_stop;
+}
+
+struct sched *sched_create(struct mt *a, int window) {
+    struct sched *s = malloc(sizeof(*s));
+    if (s == NULL) return NULL;
+    memset(s, 0, sizeof(*s));
+
+    s->mt = a;
+    s->window = (window > 0) ? window : 1;
+    s->workers = list_create();
+    if (s->workers == NULL) {
+        free(s);
+        return NULL;
+    }
+
+    if (sched_count++ == 0) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = &sched_sigint;
+        sigaction(SIGINT, &sa, &sched_old_sigint);
+        sched_stop = 0;
+    }
+    return s;
+}
+
+void sched_destroy(struct sched *s) {
+    sched_run(s);
+    while (s->workers->count > 0) {
+        struct sched_worker *w = (struct sched_worker *)list_pop(s->workers);
+        list_destroy(w->tasks);
+        free(w);
+    }
+    list_destroy(s->workers);
+    free(s);
+    if (--sched_count == 0) sigaction(SIGINT, &sched_old_sigint, NULL);
+}
+
+struct task *task_create(task_send_fn send, task_receive_fn receive,
+                         task_finished_fn finished, task_destroy_fn destroy,
+                         void *data) {
+    struct task *t = malloc(sizeof(*t));
+    if (t == NULL) return NULL;
+    memset(t, 0, sizeof(*t));
+    t->send = send;
+    t->receive = receive;
+    t->finished = finished;
+    t->destroy = destroy;
+    t->data = data;
+    return t;
+}
+
+static void task_destroy(struct task *t) {
+    t->destroy(t);
+    free(t);
+}
+
+struct probe *sched_send(struct sched *s, struct task *t, int if_index,
+                         const uint8_t *buf, uint32_t len, match_fn fn) {
+    struct probe *p = mt_send(s->mt, if_index, buf, len, fn);
+    if (p == NULL) return NULL;
+    p->data = t;
+    t->probes++;
+    return p;
+}
+
+static struct sched_worker *sched_worker(struct sched *s, int if_index) {
+    struct list_item *it = NULL;
+    for (it = s->workers->first; it != NULL; it = it->next) {
+        struct sched_worker *w = (struct sched_worker *)it->data;
+        if (w->if_index == if_index) return w;
+    }
+
+    struct sched_worker *w = malloc(sizeof(*w));
+    if (w == NULL) return NULL;
+    w->if_index = if_index;
+    w->tasks = list_create();
+    if (w->tasks == NULL) {
+        free(w);
+        return NULL;
+    }
+    list_insert(s->workers, w);
+    return w;
+}
+
+// Gives the tasks of a worker a turn each, one send per turn, for as long
+// as the send wait of its interface allows. The tasks that had their turn
+// go to the end of the list, so the next round starts with the first one
+// that was left out.
+static int sched_send_round(struct sched *s, struct sched_worker *w,
+                            struct timespec *wake) {
+    int sent = 0;
+    int k = 0;
+    int count = w->tasks->count;
+    for (k = 0; k < count && mt_send_ready(s->mt, w->if_index); k++) {
+        struct task *t = (struct task *)list_pop(w->tasks);
+        sent += t->send(s, t, wake);
+        list_insert(w->tasks, t);
+    }
+    return sent;
+}
+
+// Interfaces are paced independently, a worker waiting for its send wait
+// does not keep the others from sending
+static int sched_send_workers(struct sched *s, struct timespec *wake) {
+    int sent = 0;
+    struct list_item *it = NULL;
+    for (it = s->workers->first; it != NULL; it = it->next) {
+        sent += sched_send_round(s, (struct sched_worker *)it->data, wake);
+    }
+    return sent;
+}
+
+// Hands the answered and expired probes of every interface to their tasks
+static int sched_receive(struct sched *s) {
+    struct list *done = list_create();
+    if (done == NULL) return 0;
+
+    struct list_item *it = NULL;
+    for (it = s->mt->interfaces->first; it != NULL; it = it->next) {
+        struct interface *i = (struct interface *)it->data;
+        if (i->probes->count == 0) continue;
+        mt_poll(s->mt, i->if_index);
+        mt_pop_probes(s->mt, i->if_index, done);
+    }
+
+    int count = done->count;
+    while (done->count > 0) {
+        struct probe *p = (struct probe *)list_pop(done);
+        struct task *t = (struct task *)p->data;
+        if (t == NULL) {
+            probe_destroy(p);
+            continue;
+        }
+        t->probes--;
+        t->receive(s, t, p);
+    }
+    list_destroy(done);
+    return count;
+}
+
+static void sched_reap(struct sched *s) {
+    struct list_item *wi = NULL;
+    for (wi = s->workers->first; wi != NULL; wi = wi->next) {
+        struct sched_worker *w = (struct sched_worker *)wi->data;
+        struct list_item *it = w->tasks->first;
+        while (it != NULL) {
+            struct list_item *next = it->next;
+            struct task *t = (struct task *)it->data;
+            if (t->probes == 0 && t->finished(s, t)) {
+                list_remove_item(w->tasks, it);
+                task_destroy(t);
+                s->count--;
+            }
+            it = next;
+        }
+    }
+}
+
+static void sched_step(struct sched *s) {
+    struct timespec now, wake;
+    struct timespec idle = { 0, SCHED_IDLE_US * 1000 };
+    clock_gettime(CLOCK_REALTIME, &now);
+    wake = timespec_add(&now, &idle);
+
+    mt_refresh(s->mt);
+    int busy = sched_send_workers(s, &wake);
+    busy += sched_receive(s);
+    sched_reap(s);
+    if (busy > 0 || s->count == 0) return;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (timespec_cmp(&wake, &now) != 1) return;
+    struct timespec wait = timespec_diff(&wake, &now);
+    long us = wait.tv_sec * 1000000 + wait.tv_nsec / 1000;
+    if (us > SCHED_IDLE_US) us = SCHED_IDLE_US;
+    if (us > 0) usleep(us);
+}
+
+// Runs the tasks already added until there is room for one more
+int sched_add(struct sched *s, struct task *t) {
+    if (t == NULL) return -1;
+    struct sched_worker *w = sched_worker(s, t->if_index);
+    if (w == NULL) return -1;
+    while (s->count >= s->window) sched_step(s);
+    if (list_insert(w->tasks, t) == -1) return -1;
+    s->count++;
+    return 0;
+}
+
+void sched_run(struct sched *s) {
+    while (s->count > 0) sched_step(s);
+}
@@ -0,0 +1,106 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+#include <time.h>
+
+#include "list.h"
+#include "probe.h"
+#include "mt.h"
+
+// Longest sleep of an idle scheduler, in microseconds
+#define SCHED_IDLE_US 1000
+
+struct sched;
+struct task;
+
+// Sends the next probe of the task if it has one due and returns 1.
+// Otherwise returns 0, lowering wake to when it will have one if that is
+// known, a task that only waits for replies leaves wake as it is.
+typedef int (*task_send_fn)(struct sched *s, struct task *t,
+                            struct timespec *wake);
+
+// Hands over a probe of the task that was answered or ran out of retries
+typedef void (*task_receive_fn)(struct sched *s, struct task *t,
+                                struct probe *p);
+
+// Tells whether the task has nothing left to send
+typedef int (*task_finished_fn)(struct sched *s, struct task *t);
+
+// Reports the results of a finished task and frees its data
+typedef void (*task_destroy_fn)(struct task *t);
+
+// A resumable measurement, e.g. a traceroute or a ping to one destination
+struct task {
+    task_send_fn send;
+    task_receive_fn receive;
+    task_finished_fn finished;
+    task_destroy_fn destroy;
+    void *data;
+    int probes; // sent and not handed back yet
+    int if_index; // egress interface, picks the worker that runs the task
+};
+
+// The tasks whose probes leave through one interface. Each worker sends
+// round-robin among its tasks whenever the send wait of its interface
+// allows, so every uplink is kept busy on its own.
+struct sched_worker {
+    int if_index;
+    struct list *tasks;
+};
+
+// Multiplexes tasks over the interfaces of mt: tasks are partitioned
+// among per-interface workers and replies are handed to the task that
+// sent the probe
+struct sched {
+    struct mt *mt;
+    struct list *workers;
+    int count; // tasks running
+    int window; // most tasks running at once
+};
+
+struct sched *sched_create(struct mt *a, int window);
+
+void sched_destroy(struct sched *s);
+
+struct task *task_create(task_send_fn send, task_receive_fn receive,
+                         task_finished_fn finished, task_destroy_fn destroy,
+                         void *data);
+
+struct probe *sched_send(struct sched *s, struct task *t, int if_index,
+                         const uint8_t *buf, uint32_t len, match_fn fn);
+
+int sched_add(struct sched *s, struct task *t);
+
+void sched_run(struct sched *s);
+
+int sched_interrupted(void);
+
+#endif // __SCHED_H__
@@ -0,0 +1,186 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "stop_set.h"
+
+/* The stop sets are kept in a text file, one entry per line:
+ *
+ *   local <src> <interface>
+ *   global <interface> <destination prefix>
+ *
+ * Local entries only apply to the source that saw them, global ones are
+ * shared by every source using the file.
+ */
+
+#define STOP_SET_PREFIX4 24
+#define STOP_SET_PREFIX6 48
+
+// Items only need a non-NULL data pointer to be found
+static int stop_set_mark;
+
+struct stop_set *stop_set_create(void) {
+    struct stop_set *s = malloc(sizeof(*s));
+    if (s == NULL) return NULL;
+    memset(s, 0, sizeof(*s));
+    s->local  = hash_create(0);
+    s->global = hash_create(0);
+    if (s->local == NULL || s->global == NULL) {
+        stop_set_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+void stop_set_destroy(struct stop_set *s) {
+    if (s->local != NULL) hash_destroy(s->local);
+    if (s->global != NULL) hash_destroy(s->global);
+    free(s);
+}
+
+static void stop_set_global_key(char *key, size_t len, const char *iface,
+                                const char *prefix) {
+    snprintf(key, len, "%s %s", iface, prefix);
+}
+
+int stop_set_has_local(const struct stop_set *s, const char *iface) {
+    return hash_get(s->local, iface, strlen(iface)) != NULL;
+}
+
+int stop_set_has_global(const struct stop_set *s, const char *iface,
+                        const char *prefix) {
+    char key[STOP_SET_LINE];
+    stop_set_global_key(key, sizeof(key), iface, prefix);
+    return hash_get(s->global, key, strlen(key)) != NULL;
+}
+
+int stop_set_add_local(struct stop_set *s, const char *iface) {
+    return hash_put(s->local, iface, strlen(iface), &stop_set_mark);
+}
+
+int stop_set_add_global(struct stop_set *s, const char *iface,
+                        const char *prefix) {
+    char key[STOP_SET_LINE];
+    stop_set_global_key(key, sizeof(key), iface, prefix);
+    return hash_put(s->global, key, strlen(key), &stop_set_mark);
+}
+
+// The destination prefix global entries are kept for: /24 or /48
+char *stop_set_prefix(const struct addr *dst) {
+    struct addr *net = addr_copy(dst);
+    if (net == NULL) return NULL;
+
+    int size = (dst->type == ADDR_IPV4) ? ADDR_IPV4_SIZE : ADDR_IPV6_SIZE;
+    int len  = (dst->type == ADDR_IPV4) ? STOP_SET_PREFIX4 : STOP_SET_PREFIX6;
+    memset(net->addr + len / 8, 0, size - len / 8);
+
+    char *str = addr_to_str(net);
+    addr_destroy(net);
+    if (str == NULL) return NULL;
+
+    char *prefix = malloc(strlen(str) + 5);
+    if (prefix != NULL) sprintf(prefix, "%s/%d", str, len);
+    free(str);
+    return prefix;
+}
+
+int stop_set_load(struct stop_set *s, const char *path, const char *src) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) return 0;
+
+    char line[STOP_SET_LINE];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char kind[16], a[64], b[64];
+        if (sscanf(line, "%15s %63s %63s", kind, a, b) != 3) continue;
+        if (strcmp(kind, "local") == 0 && strcmp(a, src) == 0) {
+            stop_set_add_local(s, b);
+        } else if (strcmp(kind, "global") == 0) {
+            stop_set_add_global(s, a, b);
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+struct stop_set_writer {
+    FILE *out;
+    const char *kind;
+    const char *src;
+};
+
+static void stop_set_write(const void *key, uint32_t key_len, void *data,
+                           void *ctx) {
+    struct stop_set_writer *w = (struct stop_set_writer *)ctx;
+    if (w->src != NULL) {
+        fprintf(w->out, "%s %s %.*s\n", w->kind, w->src, (int)key_len,
+                (const char *)key);
+    } else {
+        fprintf(w->out, "%s %.*s\n", w->kind, (int)key_len, (const char *)key);
+    }
+}
+
+int stop_set_save(struct stop_set *s, const char *path, const char *src) {
+    // A truncated name could be the file itself, truncated by the open
+    char tmp_path[PATH_MAX];
+    int n = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (n < 0 || n >= (int)sizeof(tmp_path)) return -1;
+
+    FILE *out = fopen(tmp_path, "w");
+    if (out == NULL) return -1;
+
+    // Keep the local sets of the other sources, the global set was loaded
+    FILE *in = fopen(path, "r");
+    if (in != NULL) {
+        char line[STOP_SET_LINE];
+        while (fgets(line, sizeof(line), in) != NULL) {
+            char kind[16], a[64], b[64];
+            if (sscanf(line, "%15s %63s %63s", kind, a, b) != 3) continue;
+            if (strcmp(kind, "local") == 0 && strcmp(a, src) != 0) {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+
+    struct stop_set_writer local = { out, "local", src };
+    struct stop_set_writer global = { out, "global", NULL };
+    hash_fn(s->local, &stop_set_write, &local);
+    hash_fn(s->global, &stop_set_write, &global);
+
+    if (fclose(out) != 0) {
+        remove(tmp_path);
+        return -1;
+    }
+
+    return rename(tmp_path, path);
+}
@@ -0,0 +1,64 @@
+/* Copyright (c) 2016-2017, Rafael Almeida <rlca at dcc dot ufmg dot br>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of mtraceroute nor the names of its contributors may
+ *     be used to endorse or promote products derived from this software
+ *     without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __STOP_SET_H__
+#define __STOP_SET_H__
+
+#include "addr.h"
+#include "hash.h"
+
+#define STOP_SET_LINE 256
+
+// Doubletree stop sets: the local one holds the interfaces already seen
+// from a source, the global one (interface, destination prefix) pairs
+struct stop_set {
+    struct hash *local;
+    struct hash *global;
+};
+
+struct stop_set *stop_set_create(void);
+
+void stop_set_destroy(struct stop_set *s);
+
+int stop_set_load(struct stop_set *s, const char *path, const char *src);
+
+int stop_set_save(struct stop_set *s, const char *path, const char *src);
+
+char *stop_set_prefix(const struct addr *dst);
+
+int stop_set_has_local(const struct stop_set *s, const char *iface);
+
+int stop_set_has_global(const struct stop_set *s, const char *iface,
+                        const char *prefix);
+
+int stop_set_add_local(struct stop_set *s, const char *iface);
+
+int stop_set_add_global(struct stop_set *s, const char *iface,
+                        const char *prefix);
+
+#endif // __STOP_SET_H__
@@ -171,6 +171,17 @@ struct timespec timespec_diff(const struct timespec *a, const struct timespec *b
     return c;
 }
 
+struct timespec timespec_add(const struct timespec *a, const struct timespec *b) {
+    struct timespec c;
+    c.tv_sec = a->tv_sec + b->tv_sec;
+    c.tv_nsec = a->tv_nsec + b->tv_nsec;
+    if (c.tv_nsec >= 1000000000) {
+        c.tv_sec++;
+        c.tv_nsec -= 1000000000;
+    }
+    return c;
+}
+
 struct timespec timespec_diff_now(const struct timespec *t) {
     struct timespec a;
     clock_gettime(CLOCK_REALTIME, &a);
@@ -44,6 +44,7 @@ struct sockaddr *sockaddr_create(const uint8_t *addr, int family);
 struct sockaddr *sockaddr_from_str(const char *addr, int family);
 
 struct timespec timespec_diff(const struct timespec *a, const struct timespec *b);
+struct timespec timespec_add(const struct timespec *a, const struct timespec *b);
 struct timespec timespec_diff_now(const struct timespec *t);
 struct timespec timespec_from_ms(int ms);
 int timespec_to_ms(const struct timespec *t);